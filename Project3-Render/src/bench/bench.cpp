@@ -0,0 +1,405 @@
+// Microbenchmarks of the intersection, sampling and integration hot paths on
+// the fixed scene. Prints a table and optionally writes JSON for comparing
+// builds: bench --json before.json, then again after a change. With --verify
+// it instead checks the batch kernels against Object::Intersect.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+#ifdef _WIN32
+#include "common/getopt.h"
+#else
+#include <getopt.h>
+#endif
+
+#include "common/helperfunc.h"
+#include "common/sampler.h"
+#include "graphics/globillum.h"
+#include "graphics/wavefront.h"
+#include "renderer/renderer.h"
+
+using namespace VCL;
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// rays per batch, all benchmarks cycle through the same few thousand inputs
+constexpr int RAYS_ = 4096;
+// random rays of --verify per kernel build
+constexpr int VERIFY_RAYS_ = 200000;
+
+struct Options {
+  std::string filter;
+  std::string json;
+  int repetitions = 9;
+  double warmup_ms = 200;
+  double min_rep_ms = 50;
+  int light = 0;
+  int camera = 0;
+  std::string kernels;
+  bool verify = false;
+};
+
+struct Result {
+  std::string name;
+  std::string unit;  // what one op is, "ray" or "call"
+  int64_t iterations = 0;  // ops per repetition
+  std::vector<double> ns;  // per op, one entry per repetition
+
+  double Median() const {
+    std::vector<double> sorted = ns;
+    std::sort(sorted.begin(), sorted.end());
+    return sorted[sorted.size() / 2];
+  }
+};
+
+// Results feed this so the compiler cannot drop the measured work.
+volatile double sink_ = 0;
+
+double Milliseconds(Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); }
+
+class Bench {
+ public:
+  explicit Bench(const Options& options) : options_(options) {}
+
+  // batch() performs batch ops and returns something derived from them.
+  void Run(const std::string& name, const std::string& unit, const int batch,
+           const std::function<double()>& op) {
+    if (name.find(options_.filter) == std::string::npos) return;
+
+    // warm caches and clocks, and size a repetition to min_rep_ms
+    int64_t batches = 0;
+    const auto warmup = Clock::now();
+    while (Milliseconds(Clock::now() - warmup) < options_.warmup_ms || batches == 0) {
+      sink_ = sink_ + op();
+      ++batches;
+    }
+    const double batch_ms = Milliseconds(Clock::now() - warmup) / batches;
+    const int64_t per_rep = std::max<int64_t>(1, int64_t(options_.min_rep_ms / batch_ms + 1));
+
+    Result result{name, unit, per_rep * batch, {}};
+    for (int rep = 0; rep < options_.repetitions; ++rep) {
+      const auto start = Clock::now();
+      for (int64_t b = 0; b < per_rep; ++b) sink_ = sink_ + op();
+      result.ns.push_back(Milliseconds(Clock::now() - start) * 1e6 / result.iterations);
+    }
+    const auto [lo, hi] = std::minmax_element(result.ns.begin(), result.ns.end());
+    const double median = result.Median();
+    std::printf("%-28s %12.1f ns/%-4s %14.0f %s/s   +-%.1f%%\n", name.c_str(), median, unit.c_str(),
+                1e9 / median, unit.c_str(), 50 * (*hi - *lo) / median);
+    results_.push_back(std::move(result));
+  }
+
+  bool WriteJSON(const std::string& path) const {
+    std::ofstream out(path);
+    out << "{\n  \"simd_width\": " << SIMD_WIDTH_ << ",\n  \"batch_kernels\": \"" << BatchKernels()
+        << "\",\n  \"light\": " << options_.light
+        << ",\n  \"camera\": " << options_.camera << ",\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results_.size(); ++i) {
+      const Result& r = results_[i];
+      const auto [lo, hi] = std::minmax_element(r.ns.begin(), r.ns.end());
+      char line[512];
+      std::snprintf(line, sizeof(line),
+                    "%s\n    {\"name\": \"%s\", \"unit\": \"%s\", \"ns_per_op\": %.3f, "
+                    "\"ops_per_second\": %.1f, \"min_ns\": %.3f, \"max_ns\": %.3f, "
+                    "\"repetitions\": %d, \"iterations\": %lld}",
+                    i ? "," : "", r.name.c_str(), r.unit.c_str(), r.Median(), 1e9 / r.Median(), *lo,
+                    *hi, int(r.ns.size()), (long long)r.iterations);
+      out << line;
+    }
+    out << "\n  ]\n}\n";
+    return bool(out);
+  }
+
+ private:
+  Options options_;
+  std::vector<Result> results_;
+};
+
+void PrintHelp() {
+  std::cout << "--filter <text>:     Only run benchmarks whose name contains text\n"
+               "--json <file>:       Also write the results to file\n"
+               "--reps <count>:      Set repetitions per benchmark (default 9)\n"
+               "--light <mode>:      Set mode of light (0, 1, 2, 3)\n"
+               "--camera <mode>:     Set view of camera (0, 1, 2, 3)\n"
+               "--kernels <name>:    Use these batch kernels (scalar, sse4, avx2), default the best\n"
+               "--verify:            Check the scene queries of each kernel build, or of --kernels,\n"
+               "                     against the objects' own Intersect instead of benchmarking\n"
+               "--help:              Show help\n";
+  exit(1);
+}
+
+Options ParseArgs(int argc, char** argv) {
+  Options options;
+  const option long_opts[] = {{"filter", required_argument, nullptr, 'f'},
+                              {"json", required_argument, nullptr, 'j'},
+                              {"reps", required_argument, nullptr, 'r'},
+                              {"light", required_argument, nullptr, 'l'},
+                              {"camera", required_argument, nullptr, 'c'},
+                              {"kernels", required_argument, nullptr, 'k'},
+                              {"verify", no_argument, nullptr, 'v'},
+                              {"help", no_argument, nullptr, 'h'},
+                              {nullptr, no_argument, nullptr, 0}};
+  for (int opt; (opt = getopt_long(argc, argv, "f:j:r:l:c:k:vh", long_opts, nullptr)) != -1;) {
+    switch (opt) {
+      case 'f': options.filter = optarg; break;
+      case 'j': options.json = optarg; break;
+      case 'r': options.repetitions = std::max(1, std::stoi(optarg)); break;
+      case 'l': options.light = std::clamp(std::stoi(optarg), 0, 3); break;
+      case 'c': options.camera = std::clamp(std::stoi(optarg), 0, 3); break;
+      case 'k': options.kernels = optarg; break;
+      case 'v': options.verify = true; break;
+      default: PrintHelp();
+    }
+  }
+  return options;
+}
+
+// Rays from the camera towards random points of box, grown by half its size
+// so that some miss.
+std::vector<Ray> RaysAt(const Vec3& from, AABB box, Sampler& sampler) {
+  box = box.Clip(AABB(POSMIN_, POSMAX_));
+  const Vec3 grow = (box.max_ - box.min_) * real(0.25);
+  std::vector<Ray> rays;
+  rays.reserve(RAYS_);
+  for (int i = 0; i < RAYS_; ++i) {
+    const Vec3 u(sampler.Next1D(), sampler.Next1D(), sampler.Next1D());
+    const Vec3 p = box.min_ - grow + (box.max_ - box.min_ + 2 * grow).cwiseProduct(u);
+    rays.emplace_back(from, p - from);
+  }
+  return rays;
+}
+
+// the furniture comes last, after the room and the lights
+template <typename T>
+const T* FindLast(const Scene& scene) {
+  const T* found = nullptr;
+  for (const auto& obj : scene.objs_)
+    if (const T* t = dynamic_cast<const T*>(obj.get())) found = t;
+  return found;
+}
+
+// Intersect of the last object of type T, hit record included, called on
+// the concrete type as the compiled scene does.
+template <typename T>
+void BenchPrimitive(Bench& bench, const std::string& name, const Scene& scene, const Vec3& eye,
+                    Sampler& sampler) {
+  const T* obj = FindLast<T>(scene);
+  if (!obj) return;
+  const std::vector<Ray> rays = RaysAt(eye, obj->Bounds(), sampler);
+  bench.Run(name + "::Intersect", "ray", RAYS_, [&] {
+    real sum = 0;
+    HitRecord hit;
+    for (const Ray& ray : rays) {
+      if (obj->Intersect(ray, real(1e3), hit)) sum += hit.t_ + hit.n_[0];
+    }
+    return double(sum);
+  });
+}
+
+// Closest hit of ray over all objects of the scene, one by one, with the
+// room clipping of the scene queries; fills hit and returns whether any.
+bool BruteIntersect(const Scene& scene, const Ray& ray, const real tmax, HitRecord& hit) {
+  real nearest = tmax;
+  bool found = false;
+  for (const auto& obj : scene.objs_) {
+    HitRecord candidate;
+    if (obj->Intersect(ray, nearest, candidate) && Scene::InRoom(candidate.pos_)) {
+      nearest = candidate.t_;
+      hit = candidate;
+      found = true;
+    }
+  }
+  return found;
+}
+
+// Whether an object other than the closest one is hit at about the same
+// distance with the material and normal that hit reports, a tie that either
+// side may win.
+bool Tie(const Scene& scene, const Ray& ray, const HitRecord& hit) {
+  for (const auto& obj : scene.objs_) {
+    HitRecord candidate;
+    if (obj->Intersect(ray, hit.t_ * real(1.001) + real(1e-4), candidate) && Scene::InRoom(candidate.pos_) &&
+        std::abs(candidate.t_ - hit.t_) <= real(1e-3) * std::max(real(1), hit.t_) && candidate.mat_ == hit.mat_ &&
+        (candidate.n_ - hit.n_).norm() <= real(1e-2))
+      return true;
+  }
+  return false;
+}
+
+// Random rays through the room against BruteIntersect, for Scene::Intersect
+// and Scene::Occluded with the current batch kernels. Returns the number of
+// rays that disagree. Normals get a looser tolerance than distances, they
+// are sensitive to rounding at grazing hits.
+int Verify(const Scene& scene) {
+  Sampler sampler(3, 4);
+  int hits = 0, misses = 0, records = 0, occluders = 0;
+  for (int i = 0; i < VERIFY_RAYS_; ++i) {
+    const Vec3 u(sampler.Next1D(), sampler.Next1D(), sampler.Next1D());
+    const Vec3 dir(sampler.Next1D() * 2 - 1, sampler.Next1D() * 2 - 1, sampler.Next1D() * 2 - 1);
+    const Ray ray(POSMIN_ + (POSMAX_ - POSMIN_).cwiseProduct(u), dir);
+
+    HitRecord expected, hit;
+    const bool want = BruteIntersect(scene, ray, std::numeric_limits<real>::infinity(), expected);
+    const bool got = scene.Intersect(ray, hit);
+    hits += want;
+    if (want != got || (want && std::abs(hit.t_ - expected.t_) > real(1e-3) * std::max(real(1), expected.t_)))
+      ++misses;
+    else if (want && (hit.mat_ != expected.mat_ || (hit.n_ - expected.n_).norm() > real(1e-2)) && !Tie(scene, ray, hit))
+      ++records;
+
+    // emitters don't occlude
+    const real tmax = sampler.Next1D() * 5;
+    bool occluded = false;
+    for (const auto& obj : scene.objs_) {
+      HitRecord candidate;
+      if (!obj->Mat()->emissive_ && obj->Intersect(ray, tmax, candidate) && Scene::InRoom(candidate.pos_))
+        occluded = true;
+    }
+    if (occluded != scene.Occluded(ray, tmax)) ++occluders;
+  }
+  std::printf("%-8s %d rays, %d hits: %d distances, %d hit records and %d occlusions differ\n", BatchKernels(),
+              VERIFY_RAYS_, hits, misses, records, occluders);
+  return misses + records + occluders;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  spdlog::set_pattern("[%^%l%$] %v");
+  spdlog::set_level(spdlog::level::warn);
+  const Options options = ParseArgs(argc, argv);
+  if (!options.kernels.empty() && !SetBatchKernels(options.kernels)) {
+    spdlog::error("no {} batch kernels on this CPU", options.kernels);
+    return 1;
+  }
+
+  Renderer renderer;
+  renderer.Init("bench", 320, 240, true, options.light, options.camera, true, true);
+  const Scene& scene = renderer.scene_;
+  Camera& camera = *renderer.camera_;
+
+  if (options.verify) {
+    int failed = 0;
+    for (const char* kernels : {"scalar", "sse4", "avx2"}) {
+      if (!options.kernels.empty() && options.kernels != kernels) continue;
+      if (!SetBatchKernels(kernels)) {
+        std::printf("%-8s not supported by this CPU, skipped\n", kernels);
+        continue;
+      }
+      failed += Verify(scene);
+    }
+    renderer.Destroy();
+    return failed ? 1 : 0;
+  }
+
+  const Vec3 eye = camera.pos_.cast<real>();
+
+  Sampler sampler(1, 1);
+  std::vector<real> sx(RAYS_), sy(RAYS_);
+  std::vector<Ray> camera_rays;
+  for (int i = 0; i < RAYS_; ++i) {
+    sx[i] = sampler.Next1D();
+    sy[i] = sampler.Next1D();
+    camera_rays.push_back(camera.GenerateRay(sx[i], sy[i]));
+  }
+
+  Bench bench(options);
+  std::printf("batch kernels: %s\n", BatchKernels());
+  std::printf("%-28s %15s %19s\n", "benchmark", "time", "rate");
+
+  BenchPrimitive<Plane>(bench, "Plane", scene, eye, sampler);
+  BenchPrimitive<Sphere>(bench, "Sphere", scene, eye, sampler);
+  BenchPrimitive<Tetrahedron>(bench, "Tetrahedron", scene, eye, sampler);
+  BenchPrimitive<Cuboid>(bench, "Cuboid", scene, eye, sampler);
+
+  bench.Run("Scene::Intersect", "ray", RAYS_, [&] {
+    real sum = 0;
+    HitRecord hit;
+    for (const Ray& ray : camera_rays)
+      if (scene.Intersect(ray, hit)) sum += hit.t_;
+    return double(sum);
+  });
+
+  bench.Run("Camera::GenerateRay", "ray", RAYS_, [&] {
+    real sum = 0;
+    for (int i = 0; i < RAYS_; ++i) sum += camera.GenerateRay(sx[i], sy[i]).dir_[0];
+    return double(sum);
+  });
+
+  bench.Run("rand01", "call", RAYS_, [&] {
+    real sum = 0;
+    for (int i = 0; i < RAYS_; ++i) sum += rand01();
+    return double(sum);
+  });
+
+  // diffuse, glossy and mirror lobes on the first hits' normals
+  std::vector<std::pair<Vec3, Vec3>> frames;
+  for (const Ray& ray : camera_rays) {
+    HitRecord hit;
+    if (scene.Intersect(ray, hit)) frames.emplace_back(hit.n_, -ray.dir_);
+  }
+  for (const char* name : {"wood", "metal", "mirror"}) {
+    const Material* mat = scene.mats_.at(name).get();
+    bench.Run(std::string("GlobIllum::Sample/") + name, "call", int(frames.size()), [&] {
+      real sum = 0;
+      Color weight;
+      real pdf;
+      for (const auto& [n, wi] : frames) sum += GlobIllum::Sample(mat, n, wi, weight, pdf, sampler)[0];
+      return double(sum);
+    });
+  }
+
+  // whole paths per camera ray, each repetition with new random numbers
+  uint32_t pass = 0;
+  bench.Run("GlobIllum::RayTrace", "ray", RAYS_, [&] {
+    Color sum = Color::Zero();
+    ++pass;
+    for (int i = 0; i < RAYS_; ++i) {
+      Sampler s = Sampler::ForPixel(i, pass);
+      sum += GlobIllum::RayTrace(scene, camera_rays[i], s, renderer.trace_params_);
+    }
+    return double(sum.sum());
+  });
+  bench.Run("GlobIllum::PathTrace", "ray", RAYS_, [&] {
+    Color sum = Color::Zero();
+    ++pass;
+    for (int i = 0; i < RAYS_; ++i) {
+      Sampler s = Sampler::ForPixel(i, pass);
+      sum += GlobIllum::PathTrace(scene, camera_rays[i], s, renderer.trace_params_);
+    }
+    return double(sum.sum());
+  });
+  // the same paths in batches of one tile
+  GlobIllum::Wavefront wavefront;
+  std::vector<Color> radiance(TILE_SIZE_ * TILE_SIZE_);
+  bench.Run("GlobIllum::Wavefront", "ray", RAYS_, [&] {
+    Color sum = Color::Zero();
+    ++pass;
+    for (int first = 0; first < RAYS_; first += TILE_SIZE_ * TILE_SIZE_) {
+      const int n = std::min(RAYS_ - first, TILE_SIZE_ * TILE_SIZE_);
+      for (int i = first; i < first + n; ++i) {
+        HitRecord hit;
+        if (scene.Intersect(camera_rays[i], hit)) wavefront.Add(camera_rays[i], hit, Sampler::ForPixel(i, pass));
+      }
+      const int paths = wavefront.Size();
+      wavefront.Trace(scene, renderer.trace_params_, radiance.data());
+      for (int i = 0; i < paths; ++i) sum += radiance[i];
+    }
+    return double(sum.sum());
+  });
+
+  renderer.Destroy();
+  if (!options.json.empty() && !bench.WriteJSON(options.json)) {
+    spdlog::error("failed to write {}", options.json);
+    return 1;
+  }
+  return 0;
+}
@@ -1,7 +1,11 @@
 #include "helperfunc.h"
 
+#include <algorithm>
+#include <cmath>
 #include <random>
 
+#include "sampler.h"
+
 namespace VCL {
 
 unsigned char FloatToUChar(float x) { return (unsigned char)(x * 255.999); }
@@ -15,10 +19,25 @@ void ConvertColor(Vec4f input, unsigned char output[4]) {
   output[3] = FloatToUChar(input[3]);
 }
 
+unsigned char GammaToUChar(real x) {
+  return (unsigned char)std::round(std::pow(std::clamp(x, real(0), real(1)), 1 / 2.2f) * 255);
+}
+
+Vec3 SphericalDirection(const Vec3 &w, real cos_theta, real sin_theta, real phi) {
+  const Vec3 u = (std::abs(w[0]) > real(.1) ? Vec3(0, 1, 0) : Vec3(1, 0, 0)).cross(w).normalized();
+  const Vec3 v = w.cross(u);
+  return (u * (std::cos(phi) * sin_theta) + v * (std::sin(phi) * sin_theta) + w * cos_theta).normalized();
+}
+
 real rand01() {
-	static std::uniform_real_distribution<real> dist;
-	std::mt19937 rng(std::random_device{}());
-	return dist(rng);
+	thread_local Sampler rng(std::random_device{}(), std::random_device{}());
+	return rng.Next1D();
+}
+
+uint64_t HashBytes(const void *data, size_t size, uint64_t hash) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < size; ++i) hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+  return hash;
 }
 
 };  // namespace VCL
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 #include "mathtype.h"
 
 namespace VCL {
@@ -7,7 +10,16 @@ namespace VCL {
 unsigned char FloatToUChar(float x);
 int LerpInt(int a, int b, float t);
 void ConvertColor(Vec4f input, unsigned char output[4]);
+// clamp to [0, 1], apply gamma 2.2 and quantize
+unsigned char GammaToUChar(real x);
+
+// Unit vector at angle theta from the unit vector w, with azimuth phi.
+Vec3 SphericalDirection(const Vec3 &w, real cos_theta, real sin_theta, real phi);
 
+// Non-reproducible, for scene setup only; integrators take a Sampler.
 real rand01();
 
+// FNV-1a, for fingerprints of settings and files
+uint64_t HashBytes(const void *data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL);
+
 };
@@ -0,0 +1,64 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace VCL {
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string &path)
+{
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) return;
+  file_ = file;
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) return;
+  mapping_ = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping_) return;
+  data_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+  if (data_) size_ = size_t(size.QuadPart);
+}
+
+MappedFile::~MappedFile()
+{
+  if (data_) UnmapViewOfFile(data_);
+  if (mapping_) CloseHandle(mapping_);
+  if (file_) CloseHandle(file_);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &path)
+{
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void *data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      data_ = data;
+      size_ = size_t(st.st_size);
+    }
+  }
+  // the mapping stays valid without the descriptor
+  close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+  if (data_) munmap(data_, size_);
+}
+
+#endif
+
+}  // namespace VCL
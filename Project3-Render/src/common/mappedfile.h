@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace VCL {
+
+// Read-only memory mapping of a whole file; invalid if the file cannot be
+// opened or is empty.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string &path);
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool Valid() const { return data_ != nullptr; }
+  const void *Data() const { return data_; }
+  size_t Size() const { return size_; }
+
+ private:
+  void *data_ = nullptr;
+  size_t size_ = 0;
+#ifdef _WIN32
+  void *file_ = nullptr;
+  void *mapping_ = nullptr;
+#endif
+};
+
+}  // namespace VCL
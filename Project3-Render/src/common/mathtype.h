@@ -3,6 +3,8 @@
 #include <Eigen/Dense>
 #include <Eigen/Sparse>
 
+#include <limits>
+
 namespace VCL {
 using real = float;
 
@@ -97,4 +99,21 @@ struct Ray {
 	Ray(const Vec3 &ori, const Vec3 &dir) : ori_(ori), dir_(dir.normalized()) { }
 };
 
+struct AABB {
+	Vec3 min_ = Vec3::Constant(std::numeric_limits<real>::infinity());
+	Vec3 max_ = Vec3::Constant(-std::numeric_limits<real>::infinity());
+	AABB() = default;
+	AABB(const Vec3 &min, const Vec3 &max) : min_(min), max_(max) { }
+	bool Empty() const { return (min_.array() > max_.array()).any(); }
+	void Extend(const Vec3 &p) { min_ = min_.cwiseMin(p); max_ = max_.cwiseMax(p); }
+	void Extend(const AABB &b) { min_ = min_.cwiseMin(b.min_); max_ = max_.cwiseMax(b.max_); }
+	AABB Clip(const AABB &b) const { return AABB(min_.cwiseMax(b.min_), max_.cwiseMin(b.max_)); }
+	Vec3 Centroid() const { return (min_ + max_) * real(.5); }
+	real SurfaceArea() const {
+		if (Empty()) return 0;
+		const Vec3 d = max_ - min_;
+		return 2 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+	}
+};
+
 }
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+
+#include "mathtype.h"
+
+namespace VCL {
+
+// PCG32 (XSH-RR) random number generator. The whole state is two words, so a
+// fresh sampler can be derived for every pixel sample and handed down through
+// the integrators instead of sharing a locked global engine.
+class Sampler {
+ public:
+  Sampler() { Seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+  Sampler(const uint64_t seed, const uint64_t stream) { Seed(seed, stream); }
+
+  // The same (pixel, sample, seed) triple always yields the same sequence.
+  static Sampler ForPixel(const uint32_t pixel, const uint32_t sample,
+                          const uint64_t seed = 0) {
+    return Sampler(Hash((uint64_t(pixel) << 32 | sample) ^ seed), pixel);
+  }
+
+  void Seed(const uint64_t seed, const uint64_t stream) {
+    state_ = 0;
+    inc_ = (stream << 1) | 1;
+    NextUInt();
+    state_ += seed;
+    NextUInt();
+  }
+
+  uint32_t NextUInt() {
+    const uint64_t old = state_;
+    state_ = old * 6364136223846793005ULL + inc_;
+    const uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+    const uint32_t rot = uint32_t(old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+  }
+
+  // uniform in [0, 1)
+  real Next1D() { return real(NextUInt() >> 8) * real(1.0 / (1 << 24)); }
+
+  Vec2 Next2D() {
+    const real u = Next1D();
+    return Vec2(u, Next1D());
+  }
+
+  // SplitMix64 finalizer, used to decorrelate neighbouring seeds.
+  static uint64_t Hash(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+ private:
+  uint64_t state_;
+  uint64_t inc_;
+};
+
+}  // namespace VCL
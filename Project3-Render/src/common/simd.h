@@ -0,0 +1,143 @@
+#pragma once
+
+// Minimal SIMD float wrapper. The width follows the instruction set the
+// translation unit is compiled for: 8 lanes with AVX, 4 with SSE2 (always
+// available on x86-64), and a single scalar lane elsewhere.
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define VCL_SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VCL_SIMD_SSE
+#endif
+
+namespace VCL {
+
+#if defined(VCL_SIMD_AVX)
+
+constexpr int SIMD_WIDTH_ = 8;
+
+struct vmask
+{
+  __m256 m_;
+  vmask() = default;
+  explicit vmask(__m256 m) : m_(m) { }
+  friend vmask operator&(vmask a, vmask b) { return vmask(_mm256_and_ps(a.m_, b.m_)); }
+  friend vmask operator|(vmask a, vmask b) { return vmask(_mm256_or_ps(a.m_, b.m_)); }
+  friend vmask AndNot(vmask a, vmask b) { return vmask(_mm256_andnot_ps(b.m_, a.m_)); } // a & ~b
+  int Bits() const { return _mm256_movemask_ps(m_); }
+};
+
+struct vfloat
+{
+  __m256 v_;
+  vfloat() = default;
+  explicit vfloat(__m256 v) : v_(v) { }
+  vfloat(float x) : v_(_mm256_set1_ps(x)) { }
+  static vfloat Load(const float *p) { return vfloat(_mm256_loadu_ps(p)); }
+  static vfloat Convert(const int32_t *p) { return vfloat(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)p))); }
+  void Store(float *p) const { _mm256_storeu_ps(p, v_); }
+  friend vfloat operator+(vfloat a, vfloat b) { return vfloat(_mm256_add_ps(a.v_, b.v_)); }
+  friend vfloat operator-(vfloat a, vfloat b) { return vfloat(_mm256_sub_ps(a.v_, b.v_)); }
+  friend vfloat operator*(vfloat a, vfloat b) { return vfloat(_mm256_mul_ps(a.v_, b.v_)); }
+  friend vfloat operator/(vfloat a, vfloat b) { return vfloat(_mm256_div_ps(a.v_, b.v_)); }
+  friend vfloat operator-(vfloat a) { return vfloat(_mm256_xor_ps(a.v_, _mm256_set1_ps(-0.0f))); }
+  friend vmask operator<(vfloat a, vfloat b) { return vmask(_mm256_cmp_ps(a.v_, b.v_, _CMP_LT_OQ)); }
+  friend vmask operator<=(vfloat a, vfloat b) { return vmask(_mm256_cmp_ps(a.v_, b.v_, _CMP_LE_OQ)); }
+  friend vmask operator>(vfloat a, vfloat b) { return vmask(_mm256_cmp_ps(a.v_, b.v_, _CMP_GT_OQ)); }
+  friend vmask operator>=(vfloat a, vfloat b) { return vmask(_mm256_cmp_ps(a.v_, b.v_, _CMP_GE_OQ)); }
+  // like std::min / std::max, a NaN in b yields a
+  friend vfloat Min(vfloat a, vfloat b) { return vfloat(_mm256_min_ps(b.v_, a.v_)); }
+  friend vfloat Max(vfloat a, vfloat b) { return vfloat(_mm256_max_ps(b.v_, a.v_)); }
+  friend vfloat Sqrt(vfloat a) { return vfloat(_mm256_sqrt_ps(a.v_)); }
+  friend vfloat Select(vmask m, vfloat a, vfloat b) { return vfloat(_mm256_blendv_ps(b.v_, a.v_, m.m_)); }
+};
+
+#elif defined(VCL_SIMD_SSE)
+
+constexpr int SIMD_WIDTH_ = 4;
+
+struct vmask
+{
+  __m128 m_;
+  vmask() = default;
+  explicit vmask(__m128 m) : m_(m) { }
+  friend vmask operator&(vmask a, vmask b) { return vmask(_mm_and_ps(a.m_, b.m_)); }
+  friend vmask operator|(vmask a, vmask b) { return vmask(_mm_or_ps(a.m_, b.m_)); }
+  friend vmask AndNot(vmask a, vmask b) { return vmask(_mm_andnot_ps(b.m_, a.m_)); } // a & ~b
+  int Bits() const { return _mm_movemask_ps(m_); }
+};
+
+struct vfloat
+{
+  __m128 v_;
+  vfloat() = default;
+  explicit vfloat(__m128 v) : v_(v) { }
+  vfloat(float x) : v_(_mm_set1_ps(x)) { }
+  static vfloat Load(const float *p) { return vfloat(_mm_loadu_ps(p)); }
+  static vfloat Convert(const int32_t *p) { return vfloat(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)p))); }
+  void Store(float *p) const { _mm_storeu_ps(p, v_); }
+  friend vfloat operator+(vfloat a, vfloat b) { return vfloat(_mm_add_ps(a.v_, b.v_)); }
+  friend vfloat operator-(vfloat a, vfloat b) { return vfloat(_mm_sub_ps(a.v_, b.v_)); }
+  friend vfloat operator*(vfloat a, vfloat b) { return vfloat(_mm_mul_ps(a.v_, b.v_)); }
+  friend vfloat operator/(vfloat a, vfloat b) { return vfloat(_mm_div_ps(a.v_, b.v_)); }
+  friend vfloat operator-(vfloat a) { return vfloat(_mm_xor_ps(a.v_, _mm_set1_ps(-0.0f))); }
+  friend vmask operator<(vfloat a, vfloat b) { return vmask(_mm_cmplt_ps(a.v_, b.v_)); }
+  friend vmask operator<=(vfloat a, vfloat b) { return vmask(_mm_cmple_ps(a.v_, b.v_)); }
+  friend vmask operator>(vfloat a, vfloat b) { return vmask(_mm_cmpgt_ps(a.v_, b.v_)); }
+  friend vmask operator>=(vfloat a, vfloat b) { return vmask(_mm_cmpge_ps(a.v_, b.v_)); }
+  // like std::min / std::max, a NaN in b yields a
+  friend vfloat Min(vfloat a, vfloat b) { return vfloat(_mm_min_ps(b.v_, a.v_)); }
+  friend vfloat Max(vfloat a, vfloat b) { return vfloat(_mm_max_ps(b.v_, a.v_)); }
+  friend vfloat Sqrt(vfloat a) { return vfloat(_mm_sqrt_ps(a.v_)); }
+  friend vfloat Select(vmask m, vfloat a, vfloat b) { return vfloat(_mm_or_ps(_mm_and_ps(m.m_, a.v_), _mm_andnot_ps(m.m_, b.v_))); }
+};
+
+#else
+
+constexpr int SIMD_WIDTH_ = 1;
+
+struct vmask
+{
+  bool m_;
+  vmask() = default;
+  explicit vmask(bool m) : m_(m) { }
+  friend vmask operator&(vmask a, vmask b) { return vmask(a.m_ && b.m_); }
+  friend vmask operator|(vmask a, vmask b) { return vmask(a.m_ || b.m_); }
+  friend vmask AndNot(vmask a, vmask b) { return vmask(a.m_ && !b.m_); }
+  int Bits() const { return m_ ? 1 : 0; }
+};
+
+struct vfloat
+{
+  float v_;
+  vfloat() = default;
+  vfloat(float x) : v_(x) { }
+  static vfloat Load(const float *p) { return vfloat(*p); }
+  static vfloat Convert(const int32_t *p) { return vfloat(float(*p)); }
+  void Store(float *p) const { *p = v_; }
+  friend vfloat operator+(vfloat a, vfloat b) { return a.v_ + b.v_; }
+  friend vfloat operator-(vfloat a, vfloat b) { return a.v_ - b.v_; }
+  friend vfloat operator*(vfloat a, vfloat b) { return a.v_ * b.v_; }
+  friend vfloat operator/(vfloat a, vfloat b) { return a.v_ / b.v_; }
+  friend vfloat operator-(vfloat a) { return -a.v_; }
+  friend vmask operator<(vfloat a, vfloat b) { return vmask(a.v_ < b.v_); }
+  friend vmask operator<=(vfloat a, vfloat b) { return vmask(a.v_ <= b.v_); }
+  friend vmask operator>(vfloat a, vfloat b) { return vmask(a.v_ > b.v_); }
+  friend vmask operator>=(vfloat a, vfloat b) { return vmask(a.v_ >= b.v_); }
+  friend vfloat Min(vfloat a, vfloat b) { return b.v_ < a.v_ ? b.v_ : a.v_; }
+  friend vfloat Max(vfloat a, vfloat b) { return a.v_ < b.v_ ? b.v_ : a.v_; }
+  friend vfloat Sqrt(vfloat a) { return std::sqrt(a.v_); }
+  friend vfloat Select(vmask m, vfloat a, vfloat b) { return m.m_ ? a : b; }
+};
+
+#endif
+
+constexpr int SIMD_ALL_ = (1 << SIMD_WIDTH_) - 1;
+
+}  // namespace VCL
@@ -0,0 +1,106 @@
+#include "stats.h"
+
+#ifdef VCL_STATS
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+#include <spdlog/spdlog.h>
+#endif
+
+namespace VCL::Stats {
+Snapshot Snapshot::operator-(const Snapshot& before) const {
+  Snapshot delta = *this;
+  for (int i = 0; i < int(Stat::NUM); ++i) delta.counters_[i] -= before.counters_[i];
+  for (int i = 0; i < int(PathEnd::NUM); ++i) delta.path_ends_[i] -= before.path_ends_[i];
+  for (int i = 0; i < PATH_BINS_; ++i) delta.path_lengths_[i] -= before.path_lengths_[i];
+  for (size_t i = 0; i < before.thread_samples_.size() && i < delta.thread_samples_.size(); ++i)
+    delta.thread_samples_[i] -= before.thread_samples_[i];
+  return delta;
+}
+
+#ifdef VCL_STATS
+namespace {
+const char* const STAT_NAMES_[] = {"camera_rays", "cached_camera_rays", "bounce_rays", "shadow_rays",
+                                   "plane_tests", "sphere_tests", "tetrahedron_tests", "cuboid_tests",
+                                   "other_tests", "samples", "frames"};
+const char* const PATH_END_NAMES_[] = {"escaped", "emissive", "depth", "roulette", "absorbed"};
+static_assert(sizeof(STAT_NAMES_) / sizeof(*STAT_NAMES_) == size_t(Stat::NUM));
+static_assert(sizeof(PATH_END_NAMES_) / sizeof(*PATH_END_NAMES_) == size_t(PathEnd::NUM));
+
+std::mutex mutex_;
+std::vector<std::unique_ptr<ThreadRecord>> records_;
+
+double Rate(uint64_t n, double seconds) { return seconds > 0 ? double(n) / seconds : 0.0; }
+}  // namespace
+
+ThreadRecord* Register() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  records_.push_back(std::make_unique<ThreadRecord>());
+  return records_.back().get();
+}
+
+Snapshot Collect() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Snapshot total;
+  for (const auto& record : records_) {
+    for (int i = 0; i < int(Stat::NUM); ++i)
+      total.counters_[i] += record->counters_[i].load(std::memory_order_relaxed);
+    for (int i = 0; i < int(PathEnd::NUM); ++i)
+      total.path_ends_[i] += record->path_ends_[i].load(std::memory_order_relaxed);
+    for (int i = 0; i < PATH_BINS_; ++i)
+      total.path_lengths_[i] += record->path_lengths_[i].load(std::memory_order_relaxed);
+    total.thread_samples_.push_back(record->counters_[int(Stat::Samples)].load(std::memory_order_relaxed));
+  }
+  return total;
+}
+
+void Report(const Snapshot& delta, double seconds) {
+  const uint64_t frames = delta[Stat::Frames] ? delta[Stat::Frames] : 1;
+  const uint64_t rays = delta[Stat::CameraRays] + delta[Stat::BounceRays] + delta[Stat::ShadowRays];
+  spdlog::info("stats: {:.2f} Mrays/s ({} camera, {} cached, {} bounce, {} shadow per frame)",
+               Rate(rays, seconds) * 1e-6, delta[Stat::CameraRays] / frames,
+               delta[Stat::CachedCameraRays] / frames, delta[Stat::BounceRays] / frames,
+               delta[Stat::ShadowRays] / frames);
+  spdlog::info("stats: tests per ray plane {:.2f}, sphere {:.2f}, tetrahedron {:.2f}, cuboid {:.2f}",
+               double(delta[Stat::PlaneTests]) / std::max<uint64_t>(rays, 1),
+               double(delta[Stat::SphereTests]) / std::max<uint64_t>(rays, 1),
+               double(delta[Stat::TetrahedronTests]) / std::max<uint64_t>(rays, 1),
+               double(delta[Stat::CuboidTests]) / std::max<uint64_t>(rays, 1));
+
+  uint64_t paths = 0, vertices = 0;
+  for (int i = 0; i < PATH_BINS_; ++i) {
+    paths += delta.path_lengths_[i];
+    vertices += delta.path_lengths_[i] * i;
+  }
+  std::string ends;
+  for (int i = 0; i < int(PathEnd::NUM); ++i)
+    ends += fmt::format("{} {:.1f}%{}", PATH_END_NAMES_[i],
+                        100.0 * delta.path_ends_[i] / std::max<uint64_t>(paths, 1),
+                        i + 1 < int(PathEnd::NUM) ? ", " : "");
+  spdlog::info("stats: {:.2f} vertices per path, ended {}", double(vertices) / std::max<uint64_t>(paths, 1), ends);
+
+  std::string threads;
+  for (size_t i = 0; i < delta.thread_samples_.size(); ++i)
+    if (delta.thread_samples_[i])
+      threads += fmt::format(" {:.2f}", Rate(delta.thread_samples_[i], seconds) * 1e-6);
+  spdlog::info("stats: Msamples/s per thread{}", threads);
+}
+
+bool WriteJSON(const std::string& path, const Snapshot& total, double seconds) {
+  std::ofstream out(path);
+  out << "{\n  \"seconds\": " << seconds;
+  for (int i = 0; i < int(Stat::NUM); ++i) out << ",\n  \"" << STAT_NAMES_[i] << "\": " << total.counters_[i];
+  out << ",\n  \"path_ends\": {";
+  for (int i = 0; i < int(PathEnd::NUM); ++i)
+    out << (i ? ", " : "") << "\"" << PATH_END_NAMES_[i] << "\": " << total.path_ends_[i];
+  out << "},\n  \"path_lengths\": [";
+  for (int i = 0; i < PATH_BINS_; ++i) out << (i ? ", " : "") << total.path_lengths_[i];
+  out << "],\n  \"thread_samples\": [";
+  for (size_t i = 0; i < total.thread_samples_.size(); ++i) out << (i ? ", " : "") << total.thread_samples_[i];
+  out << "]\n}\n";
+  return bool(out);
+}
+#endif
+}  // namespace VCL::Stats
@@ -0,0 +1,101 @@
+#pragma once
+
+// Render statistics, compiled in only with VCL_STATS (xmake f --stats=y).
+// Without it the VCL_STAT* macros expand to nothing.
+//
+// Every thread counts into its own cache line aligned record, so counting is
+// a plain load and store; Collect() sums the records of all threads that
+// ever counted.
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace VCL {
+enum class Stat : int {
+  CameraRays = 0,  // intersected camera rays
+  CachedCameraRays,  // camera rays answered by the G-buffer
+  BounceRays,
+  ShadowRays,
+  PlaneTests,  // ray-primitive tests by type, in the scene's type order
+  SphereTests,
+  TetrahedronTests,
+  CuboidTests,
+  OtherTests,
+  Samples,
+  Frames,
+  NUM
+};
+
+// Why a path ended, Scene misses count as Escaped.
+enum class PathEnd : int { Escaped = 0, Emissive, Depth, Roulette, Absorbed, NUM };
+
+namespace Stats {
+// path lengths in vertices, the last bin collects all longer ones
+constexpr int PATH_BINS_ = 16;
+
+struct Snapshot {
+  uint64_t counters_[int(Stat::NUM)] = {};
+  uint64_t path_ends_[int(PathEnd::NUM)] = {};
+  uint64_t path_lengths_[PATH_BINS_] = {};
+  // Stat::Samples of each thread, in the order the threads first counted
+  std::vector<uint64_t> thread_samples_;
+
+  uint64_t operator[](Stat stat) const { return counters_[int(stat)]; }
+  Snapshot operator-(const Snapshot& before) const;
+};
+
+// set bits of a packet's lane mask
+inline int Lanes(int mask) {
+  int n = 0;
+  for (; mask; mask &= mask - 1) ++n;
+  return n;
+}
+
+#ifdef VCL_STATS
+// Counts of one thread. Only that thread writes them, relaxed atomics keep
+// the reads of Collect() defined without a locked instruction per count.
+struct alignas(64) ThreadRecord {
+  std::atomic<uint64_t> counters_[int(Stat::NUM)] = {};
+  std::atomic<uint64_t> path_ends_[int(PathEnd::NUM)] = {};
+  std::atomic<uint64_t> path_lengths_[PATH_BINS_] = {};
+};
+
+// a new record, owned by the registry until the program ends
+ThreadRecord* Register();
+
+inline ThreadRecord& Local() {
+  thread_local ThreadRecord* record = Register();
+  return *record;
+}
+
+inline void Bump(std::atomic<uint64_t>& counter, uint64_t n) {
+  counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline void Add(Stat stat, uint64_t n) { Bump(Local().counters_[int(stat)], n); }
+
+inline void EndPath(PathEnd end, int vertices) {
+  ThreadRecord& record = Local();
+  Bump(record.path_ends_[int(end)], 1);
+  Bump(record.path_lengths_[vertices < PATH_BINS_ ? vertices : PATH_BINS_ - 1], 1);
+}
+
+Snapshot Collect();
+// spdlog summary of the counts in delta, gathered over seconds
+void Report(const Snapshot& delta, double seconds);
+bool WriteJSON(const std::string& path, const Snapshot& total, double seconds);
+#endif
+}  // namespace Stats
+};  // namespace VCL
+
+#ifdef VCL_STATS
+#define VCL_STAT(stat, n) ::VCL::Stats::Add(::VCL::Stat::stat, n)
+#define VCL_STAT_AT(stat, offset, n) ::VCL::Stats::Add(::VCL::Stat(int(::VCL::Stat::stat) + (offset)), n)
+#define VCL_STAT_PATH(end, vertices) ::VCL::Stats::EndPath(::VCL::PathEnd::end, vertices)
+#else
+#define VCL_STAT(stat, n) ((void)0)
+#define VCL_STAT_AT(stat, offset, n) ((void)0)
+#define VCL_STAT_PATH(end, vertices) ((void)0)
+#endif
@@ -0,0 +1,187 @@
+#include "batch.h"
+
+#include "graphics/batchkernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define VCL_BATCH_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+namespace VCL {
+
+#ifdef VCL_BATCH_X86
+// graphics/kernels
+float IntersectBatchSSE4(const PrimBatch &batch, const BatchRay &ray, float tmax, bool occluders, int &lane);
+float IntersectBatchAVX2(const PrimBatch &batch, const BatchRay &ray, float tmax, bool occluders, int &lane);
+#endif
+
+namespace {
+
+// one lane at a time, for CPUs without any of the kernels
+struct V
+{
+  static constexpr int WIDTH_ = 1;
+
+  struct M
+  {
+    bool m_;
+    friend M operator&(M a, M b) { return M{a.m_ && b.m_}; }
+    friend int Bits(M a) { return a.m_ ? 1 : 0; }
+  };
+
+  float v_;
+  V() = default;
+  V(float x) : v_(x) { }
+  static V Load(const float *p) { return V(*p); }
+  friend V operator+(V a, V b) { return a.v_ + b.v_; }
+  friend V operator-(V a, V b) { return a.v_ - b.v_; }
+  friend V operator*(V a, V b) { return a.v_ * b.v_; }
+  friend V operator/(V a, V b) { return a.v_ / b.v_; }
+  friend V operator-(V a) { return -a.v_; }
+  friend M operator<(V a, V b) { return M{a.v_ < b.v_}; }
+  friend M operator<=(V a, V b) { return M{a.v_ <= b.v_}; }
+  friend M operator>(V a, V b) { return M{a.v_ > b.v_}; }
+  friend M operator>=(V a, V b) { return M{a.v_ >= b.v_}; }
+  friend V Min(V a, V b) { return b.v_ < a.v_ ? b.v_ : a.v_; }
+  friend V Max(V a, V b) { return a.v_ < b.v_ ? b.v_ : a.v_; }
+  friend V Sqrt(V a) { return std::sqrt(a.v_); }
+  friend V Select(M m, V a, V b) { return m.m_ ? a : b; }
+  friend float HMin(V a) { return a.v_; }
+};
+
+float IntersectBatchScalar(const PrimBatch &batch, const BatchRay &ray, float tmax, bool occluders, int &lane)
+{
+  return BatchKernel::Closest<V>(batch, ray, tmax, occluders, lane);
+}
+
+using Kernel = float (*)(const PrimBatch &, const BatchRay &, float, bool, int &);
+
+struct Kernels
+{
+  const char *name_;
+  Kernel kernel_;
+  bool (*supported_)();
+};
+
+bool Always() { return true; }
+
+#ifdef VCL_BATCH_X86
+#if defined(_MSC_VER)
+bool HasSSE4()
+{
+  int info[4];
+  __cpuid(info, 1);
+  return info[2] >> 19 & 1;
+}
+
+bool HasAVX2()
+{
+  int info[4];
+  __cpuid(info, 1);
+  // the OS must also save the ymm registers
+  if (!(info[2] >> 27 & 1) || !(info[2] >> 28 & 1) || (_xgetbv(0) & 6) != 6) return false;
+  __cpuidex(info, 7, 0);
+  return info[1] >> 5 & 1;
+}
+#else
+// selected_ is set before main, the CPU model may not be known yet
+bool HasSSE4()
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.1");
+}
+
+bool HasAVX2()
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#endif
+#endif
+
+// best first
+const Kernels KERNELS_[] = {
+#ifdef VCL_BATCH_X86
+  {"avx2", IntersectBatchAVX2, HasAVX2},
+  {"sse4", IntersectBatchSSE4, HasSSE4},
+#endif
+  {"scalar", IntersectBatchScalar, Always},
+};
+
+const Kernels *Best()
+{
+  for (const Kernels &kernels : KERNELS_) {
+    if (kernels.supported_()) return &kernels;
+  }
+  return nullptr;
+}
+
+const Kernels *selected_ = Best();
+
+}
+
+PrimBatch::PrimBatch()
+{
+  for (auto &row : c_) {
+    for (float &c : row) c = std::nanf("");
+  }
+  for (float &o : occluder_) o = 0;
+}
+
+float IntersectBatch(const PrimBatch &batch, const BatchRay &ray, float tmax, bool occluders, int &lane)
+{
+  return selected_->kernel_(batch, ray, tmax, occluders, lane);
+}
+
+void BatchNormal(const PrimBatch &batch, const BatchRay &ray, const int lane, const float t, float n[3], int &face)
+{
+  face = -1;
+  switch (batch.kind_) {
+  case BatchKind::Plane:
+    for (int i = 0; i < 3; ++i) n[i] = batch.c_[1 + i][lane];
+    break;
+  case BatchKind::Sphere: {
+    const float inv_rad = 1 / std::sqrt(batch.c_[3][lane]);
+    for (int i = 0; i < 3; ++i) n[i] = (ray.ori_[i] + ray.dir_[i] * t - batch.c_[i][lane]) * inv_rad;
+    break;
+  }
+  default: {
+    // the slab entered last, as in the kernel
+    int axis = 0;
+    float tnear = -std::numeric_limits<float>::infinity();
+    for (int i = 0; i < 3; ++i) {
+      const float t0 = (batch.c_[i][lane] - ray.ori_[i]) * ray.inv_[i];
+      const float t1 = (batch.c_[3 + i][lane] - ray.ori_[i]) * ray.inv_[i];
+      if (std::min(t0, t1) > tnear) tnear = std::min(t0, t1), axis = i;
+    }
+    const bool positive = ray.dir_[axis] > 0;
+    for (int i = 0; i < 3; ++i) n[i] = 0;
+    n[axis] = positive ? -1.0f : 1.0f;
+    face = 2 * axis + positive;
+  }
+  }
+}
+
+const char *BatchKernels()
+{
+  return selected_->name_;
+}
+
+bool SetBatchKernels(const std::string &name)
+{
+  for (const Kernels &kernels : KERNELS_) {
+    if (name != kernels.name_) continue;
+    if (!kernels.supported_()) return false;
+    selected_ = &kernels;
+    return true;
+  }
+  return false;
+}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+// One ray against BATCH_WIDTH_ primitives of a type at once. The kernels are
+// built for several instruction sets (graphics/kernels) and the best one the
+// CPU supports is picked at run time, so this header stays free of Eigen and
+// of anything else that would be compiled differently per kernel.
+
+#include <cstdint>
+#include <string>
+
+namespace VCL {
+
+constexpr int BATCH_WIDTH_ = 8;
+
+enum class BatchKind : uint32_t { Plane = 0, Sphere, Box, NUM };
+
+// Coefficients of up to BATCH_WIDTH_ primitives in structure-of-arrays
+// layout, lane by lane:
+//   Plane:  c_[0] dot(n, p), c_[1..3] n
+//   Sphere: c_[0..2] center, c_[3] radius^2
+//   Box:    c_[0..2] min, c_[3..5] max
+// Unused lanes are NaN and never hit.
+struct alignas(32) PrimBatch
+{
+  float c_[6][BATCH_WIDTH_];
+  // 1 for the lanes that block shadow rays, 0 otherwise
+  float occluder_[BATCH_WIDTH_];
+  BatchKind kind_;
+  uint32_t type_;   // of the primitives in the CompiledScene
+  uint32_t first_;  // index of lane 0's primitive, the others follow
+  int count_ = 0;
+
+  PrimBatch();
+};
+
+// A ray and the box its hits must lie in.
+struct BatchRay
+{
+  float ori_[3];
+  float dir_[3];
+  float inv_[3];
+  float lo_[3];
+  float hi_[3];
+  // tolerance of the plane test
+  float eps_;
+};
+
+// Nearest hit before tmax and inside the ray's box among the lanes, only
+// the occluder lanes if occluders; infinity if there is none. lane receives
+// the lane of the hit.
+float IntersectBatch(const PrimBatch &batch, const BatchRay &ray, float tmax, bool occluders, int &lane);
+
+// Geometric normal n and face (-1 for planes and spheres, as numbered by
+// Cuboid otherwise) of the hit at distance t found on lane.
+void BatchNormal(const PrimBatch &batch, const BatchRay &ray, int lane, float t, float n[3], int &face);
+
+// "scalar", "sse4" or "avx2", the kernels IntersectBatch uses.
+const char *BatchKernels();
+
+// Switches to the named kernels, false if the CPU lacks them.
+bool SetBatchKernels(const std::string &name);
+
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+// The batch kernels, written once against a lane type V and instantiated by
+// every instruction set's translation unit with its own V. V has
+// WIDTH_ lanes, a mask type M, and the arithmetic, comparisons, Min, Max,
+// Sqrt, Select, Bits and HMin (smallest lane) of common/simd.h. Only the
+// lane types may differ between the translation units, everything here must
+// stay the same.
+
+#include "graphics/batch.h"
+
+#include <limits>
+
+namespace VCL::BatchKernel {
+
+// Distances of the lanes [i, i + WIDTH_) and in ok the ones that are hits.
+
+template <typename V>
+V Plane(const PrimBatch &b, const BatchRay &r, const int i, typename V::M &ok)
+{
+  const V nx = V::Load(b.c_[1] + i), ny = V::Load(b.c_[2] + i), nz = V::Load(b.c_[3] + i);
+  const V den = nx * r.dir_[0] + ny * r.dir_[1] + nz * r.dir_[2];
+  const V num = V::Load(b.c_[0] + i) - (nx * r.ori_[0] + ny * r.ori_[1] + nz * r.ori_[2]);
+  ok = den <= V(-r.eps_);
+  return num / den;
+}
+
+template <typename V>
+V Sphere(const PrimBatch &b, const BatchRay &r, const int i, typename V::M &ok)
+{
+  const V ocx = V(r.ori_[0]) - V::Load(b.c_[0] + i);
+  const V ocy = V(r.ori_[1]) - V::Load(b.c_[1] + i);
+  const V ocz = V(r.ori_[2]) - V::Load(b.c_[2] + i);
+  const V half_b = ocx * r.dir_[0] + ocy * r.dir_[1] + ocz * r.dir_[2];
+  const V c = ocx * ocx + ocy * ocy + ocz * ocz - V::Load(b.c_[3] + i);
+  const V delta = half_b * half_b - c;
+  const V sq = Sqrt(Max(delta, V(0)));
+  const V t1 = -half_b - sq, t2 = -half_b + sq;
+  ok = (delta >= V(0)) & (t2 >= V(0));
+  return Select(t1 < V(0), t2, t1);
+}
+
+// slab test, the entry point from outside
+template <typename V>
+V Box(const PrimBatch &b, const BatchRay &r, const int i, typename V::M &ok)
+{
+  const V x0 = (V::Load(b.c_[0] + i) - r.ori_[0]) * r.inv_[0], x1 = (V::Load(b.c_[3] + i) - r.ori_[0]) * r.inv_[0];
+  const V y0 = (V::Load(b.c_[1] + i) - r.ori_[1]) * r.inv_[1], y1 = (V::Load(b.c_[4] + i) - r.ori_[1]) * r.inv_[1];
+  const V z0 = (V::Load(b.c_[2] + i) - r.ori_[2]) * r.inv_[2], z1 = (V::Load(b.c_[5] + i) - r.ori_[2]) * r.inv_[2];
+  const V tnear = Max(Max(Min(x0, x1), Min(y0, y1)), Min(z0, z1));
+  const V tfar = Min(Min(Max(x0, x1), Max(y0, y1)), Max(z0, z1));
+  ok = (tnear > V(0)) & (tnear <= tfar);
+  return tnear;
+}
+
+template <typename V>
+float Closest(const PrimBatch &batch, const BatchRay &r, const float tmax, const bool occluders, int &lane)
+{
+  constexpr int CHUNKS = BATCH_WIDTH_ / V::WIDTH_;
+  const V inf(std::numeric_limits<float>::infinity());
+  V t[CHUNKS];
+  V best(tmax);
+  for (int c = 0; c < CHUNKS; ++c) {
+    const int i = c * V::WIDTH_;
+    typename V::M ok;
+    V d;
+    switch (batch.kind_) {
+    case BatchKind::Plane: d = Plane<V>(batch, r, i, ok); break;
+    case BatchKind::Sphere: d = Sphere<V>(batch, r, i, ok); break;
+    default: d = Box<V>(batch, r, i, ok); break;
+    }
+    const V px = d * r.dir_[0] + r.ori_[0];
+    const V py = d * r.dir_[1] + r.ori_[1];
+    const V pz = d * r.dir_[2] + r.ori_[2];
+    ok = ok & (d < V(tmax)) &
+         (px >= V(r.lo_[0])) & (px <= V(r.hi_[0])) &
+         (py >= V(r.lo_[1])) & (py <= V(r.hi_[1])) &
+         (pz >= V(r.lo_[2])) & (pz <= V(r.hi_[2]));
+    if (occluders) ok = ok & (V::Load(batch.occluder_ + i) > V(0));
+    t[c] = Select(ok, d, inf);
+    best = Min(best, t[c]);
+  }
+
+  const float nearest = HMin(best);
+  if (!(nearest < tmax)) return std::numeric_limits<float>::infinity();
+  for (int c = 0; c < CHUNKS; ++c) {
+    const int bits = Bits(t[c] <= V(nearest));
+    if (!bits) continue;
+    int k = 0;
+    while (!(bits >> k & 1)) ++k;
+    lane = c * V::WIDTH_ + k;
+    break;
+  }
+  return nearest;
+}
+
+}
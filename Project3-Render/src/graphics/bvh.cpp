@@ -0,0 +1,125 @@
+#include "bvh.h"
+
+#include <algorithm>
+
+namespace VCL {
+
+void BVH::Build(const std::vector<AABB> &bounds)
+{
+  nodes_.clear();
+  indices_.clear();
+  depth_ = 0;
+  std::vector<Vec3> centroids(bounds.size());
+  for (int i = 0; i < int(bounds.size()); ++i) {
+    if (bounds[i].Empty()) continue;
+    indices_.push_back(i);
+    centroids[i] = bounds[i].Centroid();
+  }
+  if (indices_.empty()) return;
+  nodes_.reserve(2 * indices_.size());
+  BuildNode(bounds, centroids, 0, int(indices_.size()), 0);
+  assert(depth_ < STACK_SIZE_);
+}
+
+int BVH::BuildNode(const std::vector<AABB> &bounds, const std::vector<Vec3> &centroids, int begin, int end,
+                   int depth)
+{
+  depth_ = std::max(depth_, depth);
+  const int idx = int(nodes_.size());
+  nodes_.emplace_back();
+
+  AABB box, cbox;
+  for (int i = begin; i < end; ++i) {
+    box.Extend(bounds[indices_[i]]);
+    cbox.Extend(centroids[indices_[i]]);
+  }
+  nodes_[idx].box_ = box;
+
+  const int count = end - begin;
+  auto make_leaf = [&]() {
+    nodes_[idx].offset_ = begin;
+    nodes_[idx].count_ = uint16_t(count);
+    return idx;
+  };
+  if (count == 1) return make_leaf();
+
+  // deep trees, e.g. of geometrically spaced boxes, go on by object medians
+  // along the widest centroid extent
+  if (depth >= SAH_DEPTH_) {
+    if (count <= MAX_LEAF_SIZE_) return make_leaf();
+    const Vec3 extent = cbox.max_ - cbox.min_;
+    int axis = 0;
+    for (int i = 1; i < 3; ++i) {
+      if (extent[i] > extent[axis]) axis = i;
+    }
+    const int mid = (begin + end) / 2;
+    std::nth_element(indices_.begin() + begin, indices_.begin() + mid, indices_.begin() + end,
+                     [&](const int a, const int b) { return centroids[a][axis] < centroids[b][axis]; });
+    nodes_[idx].axis_ = uint16_t(axis);
+    BuildNode(bounds, centroids, begin, mid, depth + 1);
+    nodes_[idx].offset_ = BuildNode(bounds, centroids, mid, end, depth + 1);
+    return idx;
+  }
+
+  // binned SAH over the centroid bounds, traversal and intersection cost 1
+  int best_axis = -1, best_split = 0;
+  real best_cost = std::numeric_limits<real>::infinity();
+  const real inv_area = box.SurfaceArea() > 0 ? 1 / box.SurfaceArea() : 0;
+  for (int axis = 0; axis < 3; ++axis) {
+    const real extent = cbox.max_[axis] - cbox.min_[axis];
+    if (!(extent > 0)) continue;
+
+    AABB bin_box[BINS_];
+    int bin_count[BINS_] = {};
+    for (int i = begin; i < end; ++i) {
+      const int b = std::min(BINS_ - 1, int((centroids[indices_[i]][axis] - cbox.min_[axis]) * BINS_ / extent));
+      bin_box[b].Extend(bounds[indices_[i]]);
+      bin_count[b]++;
+    }
+
+    real right_area[BINS_];
+    int right_count[BINS_];
+    AABB acc;
+    int n = 0;
+    for (int b = BINS_ - 1; b > 0; --b) {
+      acc.Extend(bin_box[b]);
+      n += bin_count[b];
+      right_area[b] = acc.SurfaceArea();
+      right_count[b] = n;
+    }
+    acc = AABB();
+    n = 0;
+    for (int b = 0; b < BINS_ - 1; ++b) {
+      acc.Extend(bin_box[b]);
+      n += bin_count[b];
+      if (n == 0 || right_count[b + 1] == 0) continue;
+      const real cost = 1 + (acc.SurfaceArea() * n + right_area[b + 1] * right_count[b + 1]) * inv_area;
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_split = b + 1;
+      }
+    }
+  }
+
+  if (count <= MAX_LEAF_SIZE_ && !(best_cost < count)) return make_leaf();
+
+  int mid;
+  if (best_axis >= 0) {
+    const real extent = cbox.max_[best_axis] - cbox.min_[best_axis];
+    mid = int(std::partition(indices_.begin() + begin, indices_.begin() + end, [&](const int i) {
+      return std::min(BINS_ - 1, int((centroids[i][best_axis] - cbox.min_[best_axis]) * BINS_ / extent)) < best_split;
+    }) - indices_.begin());
+  }
+  else { // coincident centroids, split in the middle
+    best_axis = 0;
+    mid = (begin + end) / 2;
+  }
+
+  nodes_[idx].axis_ = uint16_t(best_axis);
+  BuildNode(bounds, centroids, begin, mid, depth + 1);
+  nodes_[idx].offset_ = BuildNode(bounds, centroids, mid, end, depth + 1);
+  return idx;
+}
+
+}
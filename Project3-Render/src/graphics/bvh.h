@@ -0,0 +1,136 @@
+#pragma once
+
+#include "common/mathtype.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+namespace VCL {
+
+// Bounding volume hierarchy over primitive indices, built with a binned SAH
+// and stored as a flat depth-first node array: the left child of an interior
+// node directly follows it, the right child is at offset_.
+class BVH
+{
+public:
+
+  struct Node
+  {
+    AABB box_;
+    int offset_ = 0;     // leaf: first entry in indices_, interior: right child
+    uint16_t count_ = 0; // primitives in a leaf, 0 for interior nodes
+    uint16_t axis_ = 0;  // split axis of interior nodes
+  };
+
+  static constexpr int BINS_ = 16;
+  static constexpr int MAX_LEAF_SIZE_ = 4;
+  // entries of the traversal stacks; a traversal holds at most depth + 1
+  static constexpr int STACK_SIZE_ = 64;
+  // SAH splits down to this depth, object median splits below it, which add
+  // at most log2 of the primitives left, so depth_ stays below STACK_SIZE_
+  static constexpr int SAH_DEPTH_ = 32;
+
+  std::vector<Node> nodes_;
+  std::vector<int> indices_;
+  int depth_ = 0; // of the deepest leaf, the root being at 0
+
+public:
+
+  BVH() = default;
+
+  // Primitives with an empty box are left out.
+  void Build(const std::vector<AABB> &bounds);
+
+  bool Empty() const { return nodes_.empty(); }
+
+  // Visits leaves front to back along the ray, skipping subtrees entered
+  // beyond tmax. leaf(prim, tmax) tests one primitive, may shrink tmax for
+  // closest-hit queries, and returns true to end the traversal early.
+  // Returns true if the traversal was ended by the callback.
+  template <typename Leaf>
+  bool Traverse(const Ray &ray, real &tmax, Leaf &&leaf) const;
+
+  // Per-ray constants of the slab test.
+  struct RayInv
+  {
+    real org_inv_[3]; // ori * inv
+    real inv_[3];
+    int near_[3];     // offset of the near slab bound in a node box, 0 or 3
+
+    explicit RayInv(const Ray &ray)
+    {
+      for (int i = 0; i < 3; ++i) {
+        inv_[i] = 1 / ray.dir_[i];
+        org_inv_[i] = ray.ori_[i] * inv_[i];
+        near_[i] = inv_[i] < 0 ? 3 : 0;
+      }
+    }
+  };
+
+  // Slab test against [0, tmax]. Rays lying in a slab plane give NaNs, which
+  // are ignored.
+  static bool IntersectBox(const AABB &box, const RayInv &r, const real tmax, real &tnear)
+  {
+    static_assert(sizeof(AABB) == 6 * sizeof(real), "AABB must be min_ followed by max_");
+    const real *const b = box.min_.data();
+    const real x0 = b[r.near_[0]] * r.inv_[0] - r.org_inv_[0];
+    const real x1 = b[3 - r.near_[0]] * r.inv_[0] - r.org_inv_[0];
+    const real y0 = b[1 + r.near_[1]] * r.inv_[1] - r.org_inv_[1];
+    const real y1 = b[4 - r.near_[1]] * r.inv_[1] - r.org_inv_[1];
+    const real z0 = b[2 + r.near_[2]] * r.inv_[2] - r.org_inv_[2];
+    const real z1 = b[5 - r.near_[2]] * r.inv_[2] - r.org_inv_[2];
+    // a NaN as second argument of std::max / std::min is dropped
+    const real t0 = std::max(std::max(std::max(real(0), x0), y0), z0);
+    const real t1 = std::min(std::min(std::min(tmax, x1), y1), z1);
+    tnear = t0;
+    return t0 <= t1;
+  }
+
+private:
+
+  int BuildNode(const std::vector<AABB> &bounds, const std::vector<Vec3> &centroids, int begin, int end,
+                int depth);
+};
+
+template <typename Leaf>
+bool BVH::Traverse(const Ray &ray, real &tmax, Leaf &&leaf) const
+{
+  if (nodes_.empty()) return false;
+
+  const RayInv inv(ray);
+  struct Entry { int node; real t; };
+  Entry stack[STACK_SIZE_];
+  int top = 0;
+
+  real t;
+  if (!IntersectBox(nodes_[0].box_, inv, tmax, t)) return false;
+  stack[top++] = {0, t};
+
+  while (top > 0) {
+    const Entry entry = stack[--top];
+    if (entry.t > tmax) continue;
+    const Node &node = nodes_[entry.node];
+
+    if (node.count_ > 0) {
+      for (int i = 0; i < node.count_; ++i) {
+        if (leaf(indices_[node.offset_ + i], tmax)) return true;
+      }
+      continue;
+    }
+
+    int first = entry.node + 1, second = node.offset_;
+    if (inv.near_[node.axis_]) std::swap(first, second);
+    real t_first, t_second;
+    const bool hit_first = IntersectBox(nodes_[first].box_, inv, tmax, t_first);
+    const bool hit_second = IntersectBox(nodes_[second].box_, inv, tmax, t_second);
+    // push the far child first so the near one is popped next
+    assert(top + 2 <= STACK_SIZE_);
+    if (hit_second) stack[top++] = {second, t_second};
+    if (hit_first) stack[top++] = {first, t_first};
+  }
+  return false;
+}
+
+}
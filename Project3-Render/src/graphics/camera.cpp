@@ -24,20 +24,20 @@ void Camera::Rotate(const float dx, const float dy) {
   phi_ = std::fmod(phi_, 2.0f * PI_);
   if (phi_ < 0.0f) phi_ += 2.0f * PI_;
   theta_ = std::clamp(theta_, 0.1f, PI_ - 0.1f);
-  LookAt(SphericalToCartesian(radius_, phi_, theta_), target_);
+  LookAt(SphericalToCartesian(radius_, phi_, theta_) + target_, target_);
 }
 
 void Camera::Translate(const float dx, const float dy) {
   static constexpr float trans_ratio = 0.001f;
   target_ += trans_ratio * radius_ * (dy * up_ - dx * right_);
-  LookAt(SphericalToCartesian(radius_, phi_, theta_), target_);
+  LookAt(SphericalToCartesian(radius_, phi_, theta_) + target_, target_);
 }
 
 void Camera::Scale(const float dy) {
   static constexpr float scale_ratio = 0.05f;
   radius_ /= std::exp(scale_ratio * dy);
   radius_ = std::clamp(radius_, 0.1f, 150.0f);
-  LookAt(SphericalToCartesian(radius_, phi_, theta_), target_);
+  LookAt(SphericalToCartesian(radius_, phi_, theta_) + target_, target_);
 }
 
 void Camera::ResetAspect(const float aspect) {
@@ -99,4 +99,25 @@ Ray Camera::GenerateRay(const real sx, const real sy) {
   const real dx = dy * aspect_;
   return Ray(pos_, lookat_ + ty * dy * up_ + tx * dx * right_);
 }
+
+void Camera::GeneratePacket(const real* sx, const real* sy, const int n,
+                            RayPacket& packet) {
+  const real dy = tan(fovy_ / 2);
+  const real dx = dy * aspect_;
+  const vfloat tx = (vfloat::Load(sx) * 2 - 1) * dx;
+  const vfloat ty = (vfloat::Load(sy) * 2 - 1) * dy;
+  const vfloat x = ty * up_.x() + tx * right_.x() + lookat_.x();
+  const vfloat y = ty * up_.y() + tx * right_.y() + lookat_.y();
+  const vfloat z = ty * up_.z() + tx * right_.z() + lookat_.z();
+  const vfloat inv_len = vfloat(1) / Sqrt(x * x + y * y + z * z);
+  (x * inv_len).Store(packet.dx_);
+  (y * inv_len).Store(packet.dy_);
+  (z * inv_len).Store(packet.dz_);
+  for (int i = 0; i < SIMD_WIDTH_; ++i) {
+    packet.ox_[i] = pos_.x();
+    packet.oy_[i] = pos_.y();
+    packet.oz_[i] = pos_.z();
+  }
+  packet.active_ = (1 << n) - 1;
+}
 };  // namespace VCL
\ No newline at end of file
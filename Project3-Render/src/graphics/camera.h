@@ -3,6 +3,7 @@
 #include <vector>
 
 #include "common/mathtype.h"
+#include "graphics/packet.h"
 
 namespace VCL {
 class Camera {
@@ -55,5 +56,8 @@ class Camera {
   }
 
   Ray GenerateRay(const real sx, const real sy); // sx, sy in [0, 1]
+  // SIMD_WIDTH_ rays from sx[i], sy[i], only the first n lanes are active
+  void GeneratePacket(const real* sx, const real* sy, const int n,
+                      RayPacket& packet);
 };
 };  // namespace VCL
\ No newline at end of file
@@ -0,0 +1,231 @@
+#pragma once
+
+#include "graphics/batch.h"
+#include "graphics/bvh.h"
+#include "graphics/object.h"
+#include "graphics/packet.h"
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+namespace VCL {
+
+// Reference to a primitive of a CompiledScene: its concrete type and its
+// index in the array of that type. A ref of type BATCH_ is a batch instead.
+struct PrimRef
+{
+  uint32_t type_;
+  uint32_t index_;
+};
+
+// The primitive types with batch kernels, and their lanes' coefficients.
+
+inline BatchKind BatchKindOf(const Plane &) { return BatchKind::Plane; }
+inline BatchKind BatchKindOf(const Sphere &) { return BatchKind::Sphere; }
+inline BatchKind BatchKindOf(const Cuboid &) { return BatchKind::Box; }
+inline BatchKind BatchKindOf(const Object &) { return BatchKind::NUM; }
+
+inline void PackLane(PrimBatch &batch, const int lane, const Plane &plane)
+{
+  batch.c_[0][lane] = plane.Normal().dot(plane.Point());
+  for (int i = 0; i < 3; ++i) batch.c_[1 + i][lane] = plane.Normal()[i];
+}
+
+inline void PackLane(PrimBatch &batch, const int lane, const Sphere &sphere)
+{
+  for (int i = 0; i < 3; ++i) batch.c_[i][lane] = sphere.Center()[i];
+  batch.c_[3][lane] = sphere.Radius() * sphere.Radius();
+}
+
+inline void PackLane(PrimBatch &batch, const int lane, const Cuboid &cuboid)
+{
+  const AABB box = cuboid.Bounds();
+  for (int i = 0; i < 3; ++i) {
+    batch.c_[i][lane] = box.min_[i];
+    batch.c_[3 + i][lane] = box.max_[i];
+  }
+}
+
+inline void PackLane(PrimBatch &, const int, const Object &) { }
+
+// Flattened copy of a scene's objects, grouped by concrete type into
+// contiguous arrays. Visit() dispatches on the type tag at compile time, so
+// calls on the listed (final) primitive types are direct and inlined.
+// Objects of any other type are kept by pointer and called virtually.
+template <typename... Ts>
+class CompiledScene
+{
+public:
+
+  static constexpr uint32_t OTHER_ = sizeof...(Ts);
+  static constexpr uint32_t BATCH_ = OTHER_ + 1;
+
+  std::tuple<std::vector<Ts>...> prims_;
+  std::vector<const Object *> others_;
+  // primitives of the types with batch kernels, up to BATCH_WIDTH_ close
+  // ones of a type per batch
+  std::vector<PrimBatch> batches_;
+  std::vector<PrimRef> refs_; // in BVH leaf order
+  BVH bvh_;
+
+public:
+
+  // Boxes are clipped to clip and grown by pad. Objects that are not of one
+  // of the listed types are referenced, so they must outlive the result.
+  void Build(const std::vector<std::unique_ptr<Object>> &objs, const AABB &clip, const real pad)
+  {
+    std::apply([](auto &...arrays) { (arrays.clear(), ...); }, prims_);
+    others_.clear();
+    batches_.clear();
+    refs_.clear();
+
+    std::vector<AABB> bounds;
+    bounds.reserve(objs.size());
+    for (const auto &object : objs) {
+      AABB box = object->Bounds().Clip(clip);
+      box.min_ -= Vec3::Constant(pad);
+      box.max_ += Vec3::Constant(pad);
+      bounds.push_back(box);
+    }
+    // a first hierarchy over the objects orders them by position, so that
+    // consecutive primitives of a type make compact batches
+    bvh_.Build(bounds);
+
+    std::vector<PrimRef> entries;
+    std::vector<AABB> entry_bounds;
+    int open[sizeof...(Ts)];     // batch being filled per type
+    int open_entry[sizeof...(Ts)];
+    std::fill(open, open + sizeof...(Ts), -1);
+    for (const int i : bvh_.indices_) {
+      const PrimRef ref = Append<0>(*objs[i]);
+      const BatchKind kind = ref.type_ < OTHER_ ? Visit(ref, [](const auto &prim) { return BatchKindOf(prim); })
+                                                : BatchKind::NUM;
+      if (kind == BatchKind::NUM) {
+        entries.push_back(ref);
+        entry_bounds.push_back(bounds[i]);
+        continue;
+      }
+      if (open[ref.type_] < 0 || batches_[open[ref.type_]].count_ == BATCH_WIDTH_) {
+        open[ref.type_] = int(batches_.size());
+        open_entry[ref.type_] = int(entries.size());
+        batches_.emplace_back();
+        batches_.back().kind_ = kind;
+        batches_.back().type_ = ref.type_;
+        batches_.back().first_ = ref.index_;
+        entries.push_back(PrimRef{BATCH_, uint32_t(open[ref.type_])});
+        entry_bounds.emplace_back();
+      }
+      PrimBatch &batch = batches_[open[ref.type_]];
+      Visit(ref, [&](const auto &prim) {
+        PackLane(batch, batch.count_, prim);
+        batch.occluder_[batch.count_] = prim.Mat()->emissive_ ? 0.0f : 1.0f;
+      });
+      ++batch.count_;
+      entry_bounds[open_entry[ref.type_]].Extend(bounds[i]);
+    }
+
+    bvh_.Build(entry_bounds);
+    // store the entries in leaf order so traversal walks memory forwards
+    for (int &i : bvh_.indices_) {
+      refs_.push_back(entries[i]);
+      i = int(refs_.size()) - 1;
+    }
+  }
+
+  // f(ref) for the primitive of ref, or for each one of a batch
+  template <typename F>
+  void ForEach(const PrimRef ref, F &&f) const
+  {
+    if (ref.type_ != BATCH_) {
+      f(ref);
+      return;
+    }
+    const PrimBatch &batch = batches_[ref.index_];
+    for (int i = 0; i < batch.count_; ++i) f(PrimRef{batch.type_, batch.first_ + i});
+  }
+
+  int Size() const { return int(refs_.size()); }
+
+  // f(prim) with prim of its concrete type, or const Object & for others
+  template <typename F>
+  decltype(auto) Visit(const PrimRef ref, F &&f) const { return VisitImpl<0>(ref, f); }
+
+  // leaf(ref, tmax) as in BVH::Traverse
+  template <typename Leaf>
+  bool Traverse(const Ray &ray, real &tmax, Leaf &&leaf) const
+  {
+    return bvh_.Traverse(ray, tmax, [&](const int i, real &t) { return leaf(refs_[i], t); });
+  }
+
+  // Packet version of Traverse. A node is entered if any lane in active hits
+  // it before its own tmax; leaf(ref, tmax, hit) gets the mask of those lanes.
+  // Children are ordered by the direction of the first active lane.
+  template <typename Leaf>
+  void TraversePacket(const PacketRays &rays, const RayPacket &packet, vfloat &tmax, const int active, Leaf &&leaf) const
+  {
+    const auto &nodes = bvh_.nodes_;
+    if (nodes.empty() || !active) return;
+
+    int lane = 0;
+    while (!(active >> lane & 1)) ++lane;
+    const bool negative[3] = {packet.dx_[lane] < 0, packet.dy_[lane] < 0, packet.dz_[lane] < 0};
+
+    int stack[BVH::STACK_SIZE_];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+      const int index = stack[--top];
+      const BVH::Node &node = nodes[index];
+      vfloat tnear;
+      const int hit = IntersectBoxPacket(node.box_, rays, tmax, tnear).Bits() & active;
+      if (!hit) continue;
+
+      if (node.count_ > 0) {
+        for (int i = 0; i < node.count_; ++i) leaf(refs_[bvh_.indices_[node.offset_ + i]], tmax, hit);
+        continue;
+      }
+
+      int first = index + 1, second = node.offset_;
+      if (negative[node.axis_]) std::swap(first, second);
+      assert(top + 2 <= BVH::STACK_SIZE_);
+      stack[top++] = second;
+      stack[top++] = first;
+    }
+  }
+
+private:
+
+  template <size_t I>
+  PrimRef Append(const Object &object)
+  {
+    if constexpr (I == sizeof...(Ts)) {
+      others_.push_back(&object);
+      return PrimRef{OTHER_, uint32_t(others_.size() - 1)};
+    }
+    else {
+      using T = std::tuple_element_t<I, std::tuple<Ts...>>;
+      if (const T *prim = dynamic_cast<const T *>(&object)) {
+        std::get<I>(prims_).push_back(*prim);
+        return PrimRef{uint32_t(I), uint32_t(std::get<I>(prims_).size() - 1)};
+      }
+      return Append<I + 1>(object);
+    }
+  }
+
+  template <size_t I, typename F>
+  decltype(auto) VisitImpl(const PrimRef ref, F &f) const
+  {
+    if constexpr (I == sizeof...(Ts)) {
+      return f(*others_[ref.index_]);
+    }
+    else {
+      if (ref.type_ == I) return f(std::get<I>(prims_)[ref.index_]);
+      return VisitImpl<I + 1>(ref, f);
+    }
+  }
+};
+
+}
@@ -0,0 +1,172 @@
+#include "denoiser.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <new>
+
+#include "common/simd.h"
+
+namespace VCL {
+namespace {
+constexpr int PLANES_ = 15;  // two colors and variances, albedo, normal, depth
+
+// edge stopping: luminance in standard deviations, albedo linear, depth
+// relative per pixel
+constexpr float SIGMA_LUMINANCE_ = 4.0f;
+constexpr float SIGMA_ALBEDO_ = 0.1f;
+constexpr float SIGMA_DEPTH_ = 8.0f;
+constexpr int NORMAL_POWER_LOG2_ = 6;
+
+// pixels below two samples have no variance estimate
+constexpr float MAX_VARIANCE_ = 1e4f;
+
+constexpr float KERNEL_[5] = {1 / 16.0f, 1 / 4.0f, 3 / 8.0f, 1 / 4.0f, 1 / 16.0f};
+
+vfloat Luminance(const vfloat* c) {
+  return vfloat(0.2126f) * c[0] + vfloat(0.7152f) * c[1] + vfloat(0.0722f) * c[2];
+}
+
+// (1 - x / 16)^16, close enough to exp(-x) for weights and 0 from x = 16 on
+vfloat ExpNeg(const vfloat x) {
+  vfloat t = Max(vfloat(0), vfloat(1) - x * (1 / 16.0f));
+  for (int i = 0; i < 4; ++i) t = t * t;
+  return t;
+}
+}  // namespace
+
+Denoiser::Denoiser(int width, int height) : width_(width), height_(height) {
+  // a row is read a whole SIMD_WIDTH_ chunk past its end, which the apron covers
+  static_assert(APRON_ >= SIMD_WIDTH_, "apron narrower than a SIMD chunk");
+  stride_ = (width + 2 * APRON_ + 15) / 16 * 16;
+  plane_ = stride_ * (height + 2 * APRON_);
+  data_ = static_cast<float*>(
+      ::operator new[](sizeof(float) * plane_ * PLANES_, std::align_val_t(64)));
+  std::memset(data_, 0, sizeof(float) * plane_ * PLANES_);
+  for (int k = 0; k < 3; ++k) {
+    color_[0][k] = data_ + plane_ * k;
+    color_[1][k] = data_ + plane_ * (3 + k);
+    albedo_[k] = data_ + plane_ * (6 + k);
+    normal_[k] = data_ + plane_ * (9 + k);
+  }
+  depth_ = data_ + plane_ * 12;
+  variance_[0] = data_ + plane_ * 13;
+  variance_[1] = data_ + plane_ * 14;
+}
+
+Denoiser::~Denoiser() { ::operator delete[](data_, std::align_val_t(64)); }
+
+void Denoiser::Load(const Film& film, int y0, int y1) {
+  for (int y = y0; y < y1; ++y) {
+    for (int x = 0; x < width_; ++x) {
+      const int i = Index(x, y);
+      const Color c = film.Mean(x, y);
+      const Guide guide = film.MeanGuide(x, y);
+      for (int k = 0; k < 3; ++k) {
+        color_[0][k][i] = c[k];
+        albedo_[k][i] = guide.albedo_[k];
+        normal_[k][i] = guide.normal_[k];
+      }
+      depth_[i] = guide.depth_;
+      variance_[0][i] = float(std::min(film.Variance(x, y), real(MAX_VARIANCE_)));
+    }
+  }
+}
+
+void Denoiser::Filter(int pass, int y0, int y1) {
+  const int step = 1 << pass;
+  const float* const* in = color_[pass & 1];
+  float* const* out = color_[(pass + 1) & 1];
+  const float* const var_in = variance_[pass & 1];
+  float* const var_out = variance_[(pass + 1) & 1];
+
+  const vfloat inv_albedo(1 / (SIGMA_ALBEDO_ * SIGMA_ALBEDO_));
+  const vfloat center(KERNEL_[2] * KERNEL_[2]);
+
+  // offsets and weights of the 24 outer taps
+  int offset[24];
+  float kernel[24], depth_scale[24];
+  int taps = 0;
+  for (int dy = -2; dy <= 2; ++dy) {
+    for (int dx = -2; dx <= 2; ++dx) {
+      if (!dx && !dy) continue;
+      offset[taps] = (dy * stride_ + dx) * step;
+      kernel[taps] = KERNEL_[dx + 2] * KERNEL_[dy + 2];
+      depth_scale[taps] = height_ / (SIGMA_DEPTH_ * step * std::sqrt(float(dx * dx + dy * dy)));
+      ++taps;
+    }
+  }
+  alignas(32) float lanes[SIMD_WIDTH_];
+  for (int k = 0; k < SIMD_WIDTH_; ++k) lanes[k] = float(k);
+
+  for (int y = y0; y < y1; ++y) {
+    for (int x = 0; x < width_; x += SIMD_WIDTH_) {
+      const int i = Index(x, y);
+      vfloat c0[3], a0[3], n0[3], sum[3];
+      for (int k = 0; k < 3; ++k) {
+        c0[k] = vfloat::Load(in[k] + i);
+        a0[k] = vfloat::Load(albedo_[k] + i);
+        n0[k] = vfloat::Load(normal_[k] + i);
+        sum[k] = c0[k] * center;
+      }
+      const vfloat l0 = Luminance(c0);
+      const vfloat var0 = vfloat::Load(var_in + i);
+      // the variance of few samples is noisy itself, SVGF blurs it first
+      vfloat var_blur(0);
+      for (int dy = -1; dy <= 1; ++dy) {
+        for (int dx = -1; dx <= 1; ++dx) {
+          const float g = (dx ? 0.25f : 0.5f) * (dy ? 0.25f : 0.5f);
+          var_blur = var_blur + vfloat(g) * vfloat::Load(var_in + i + dy * stride_ + dx);
+        }
+      }
+      const vfloat inv_sigma = vfloat(1) / (vfloat(SIGMA_LUMINANCE_) * Sqrt(var_blur) + vfloat(1e-4f));
+      const vfloat z0 = vfloat::Load(depth_ + i);
+      const vfloat inv_z = vfloat(1) / z0;
+      vfloat weight_sum = center;
+      vfloat var_sum = center * center * var0;
+
+      for (int t = 0; t < taps; ++t) {
+        const int j = i + offset[t];
+        vfloat c[3], albedo_dist(0), cos(0);
+        for (int k = 0; k < 3; ++k) {
+          c[k] = vfloat::Load(in[k] + j);
+          const vfloat da = vfloat::Load(albedo_[k] + j) - a0[k];
+          albedo_dist = albedo_dist + da * da;
+          cos = cos + n0[k] * vfloat::Load(normal_[k] + j);
+        }
+        const vfloat dl = Luminance(c) - l0;
+        const vfloat dz = vfloat::Load(depth_ + j) - z0;
+        const vfloat depth_dist = Max(dz, -dz) * inv_z * vfloat(depth_scale[t]);
+        // the apron and missed pixels have no normal and get no weight
+        vfloat normal_weight = Max(vfloat(0), cos);
+        for (int p = 0; p < NORMAL_POWER_LOG2_; ++p) normal_weight = normal_weight * normal_weight;
+        const vfloat w = vfloat(kernel[t]) * normal_weight *
+                         ExpNeg(Max(dl, -dl) * inv_sigma + albedo_dist * inv_albedo + depth_dist);
+        for (int k = 0; k < 3; ++k) sum[k] = sum[k] + w * c[k];
+        weight_sum = weight_sum + w;
+        var_sum = var_sum + w * w * vfloat::Load(var_in + j);
+      }
+
+      // lanes past the row end stay 0 so they add nothing to later passes
+      const vmask inside = vfloat::Load(lanes) + vfloat(float(x)) < vfloat(float(width_));
+      for (int k = 0; k < 3; ++k) Select(inside, sum[k] / weight_sum, vfloat(0)).Store(out[k] + i);
+      Select(inside, var_sum / (weight_sum * weight_sum), vfloat(0)).Store(var_out + i);
+    }
+  }
+}
+
+void Denoiser::Resolve(int y0, int y1, unsigned char* rgba) const {
+  const float* const* result = color_[PASSES_ & 1];
+  for (int y = y0; y < y1; ++y) {
+    const int i = Index(0, y);
+    ResolveSpan(result[0] + i, result[1] + i, result[2] + i, nullptr, width_,
+                rgba + y * width_ * 4);
+  }
+}
+
+Color Denoiser::Mean(int x, int y) const {
+  const float* const* result = color_[PASSES_ & 1];
+  const int i = Index(x, y);
+  return Color(result[0][i], result[1][i], result[2][i]);
+}
+};  // namespace VCL
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "common/mathtype.h"
+#include "graphics/film.h"
+
+namespace VCL {
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010). Each pass
+// blurs with a 5x5 B3 spline kernel whose taps lie 2^pass pixels apart and
+// weights every tap by how close its albedo, normal and depth are to the
+// center pixel's, so the blur stops at edges. Luminance differences count
+// relative to the center's noise as in SVGF (Schied et al. 2017), which
+// filters the variance along with the color. Passes work on row bands that
+// can run in parallel; a pass needs all rows of the previous one.
+class Denoiser {
+ public:
+  static constexpr int PASSES_ = 5;
+
+  Denoiser(int width, int height);
+  ~Denoiser();
+  Denoiser(const Denoiser&) = delete;
+  Denoiser& operator=(const Denoiser&) = delete;
+
+  // copies the means and guides of rows [y0, y1) of the film
+  void Load(const Film& film, int y0, int y1);
+  void Filter(int pass, int y0, int y1);
+  // Writes the gamma corrected result of rows [y0, y1) to an RGBA image of
+  // the film's size, like Film::Resolve.
+  void Resolve(int y0, int y1, unsigned char* rgba) const;
+
+  // result after the last pass
+  Color Mean(int x, int y) const;
+
+ private:
+  // reach of the widest pass, the planes have a zero border this wide
+  static constexpr int APRON_ = 2 << (PASSES_ - 1);
+
+  int Index(int x, int y) const { return (y + APRON_) * stride_ + x + APRON_; }
+
+  int width_;
+  int height_;
+  int stride_;
+  int plane_;
+  float* data_ = nullptr;
+  // passes alternate between the two
+  float* color_[2][3];
+  float* variance_[2];
+  float* albedo_[3];
+  float* normal_[3];
+  float* depth_;
+};
+};  // namespace VCL
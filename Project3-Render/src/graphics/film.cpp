@@ -0,0 +1,144 @@
+#include "film.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <new>
+
+#include "common/helperfunc.h"
+#include "common/simd.h"
+
+namespace VCL {
+namespace {
+constexpr int LUT_SIZE_ = 4096;
+// r, g, b, squared luminance, albedo, normal, depth, count
+constexpr int PLANES_ = 12;
+
+// GammaToUChar indexed by the square root of the linear value, which spreads
+// the entries where the gamma curve is steep
+const std::array<unsigned char, LUT_SIZE_>& GammaLUT() {
+  static const std::array<unsigned char, LUT_SIZE_> lut = [] {
+    std::array<unsigned char, LUT_SIZE_> t;
+    for (int i = 0; i < LUT_SIZE_; ++i) {
+      const real s = real(i) / (LUT_SIZE_ - 1);
+      t[i] = GammaToUChar(s * s);
+    }
+    return t;
+  }();
+  return lut;
+}
+}  // namespace
+
+void ResolveSpan(const float* r, const float* g, const float* b, const int32_t* count, int n,
+                 unsigned char* rgba) {
+  const auto& lut = GammaLUT();
+  const float* const planes[3] = {r, g, b};
+  alignas(32) float index[3][SIMD_WIDTH_];
+
+  int x = 0;
+  for (; x + SIMD_WIDTH_ <= n; x += SIMD_WIDTH_) {
+    vfloat inv(1);
+    if (count) {
+      const vfloat c = vfloat::Convert(count + x);
+      inv = Select(c > vfloat(0), vfloat(1) / c, vfloat(0));
+    }
+    for (int c = 0; c < 3; ++c) {
+      // NaNs end up as 0
+      const vfloat v = Min(vfloat(1), Max(vfloat(0), vfloat::Load(planes[c] + x) * inv));
+      (Sqrt(v) * (LUT_SIZE_ - 1) + 0.5f).Store(index[c]);
+    }
+    for (int k = 0; k < SIMD_WIDTH_; ++k) {
+      unsigned char* const px = rgba + (x + k) * 4;
+      for (int c = 0; c < 3; ++c) px[c] = lut[int(index[c][k])];
+    }
+  }
+  for (; x < n; ++x) {
+    const real inv = !count ? real(1) : count[x] > 0 ? real(1) / count[x] : real(0);
+    unsigned char* const px = rgba + x * 4;
+    for (int c = 0; c < 3; ++c) {
+      const real v = std::min(real(1), std::max(real(0), planes[c][x] * inv));
+      px[c] = lut[int(std::sqrt(v) * (LUT_SIZE_ - 1) + 0.5f)];
+    }
+  }
+}
+
+Film::Film(int width, int height) : width_(width), height_(height) {
+  plane_ = (width * height + 15) / 16 * 16;
+  data_ = static_cast<float*>(
+      ::operator new[](sizeof(float) * plane_ * PLANES_, std::align_val_t(64)));
+  r_ = data_;
+  g_ = data_ + plane_;
+  b_ = data_ + plane_ * 2;
+  y2_ = data_ + plane_ * 3;
+  for (int k = 0; k < 3; ++k) {
+    albedo_[k] = data_ + plane_ * (4 + k);
+    normal_[k] = data_ + plane_ * (7 + k);
+  }
+  depth_ = data_ + plane_ * 10;
+  static_assert(sizeof(int32_t) == sizeof(float), "counts share the float block");
+  count_ = reinterpret_cast<int32_t*>(data_ + plane_ * 11);
+  Reset();
+}
+
+Film::~Film() { ::operator delete[](data_, std::align_val_t(64)); }
+
+void Film::Reset() { std::memset(data_, 0, StateSize()); }
+
+size_t Film::StateSize() const { return sizeof(float) * plane_ * PLANES_; }
+
+void Film::LoadState(const void* state) { std::memcpy(data_, state, StateSize()); }
+
+void Film::MergeState(const void* state) {
+  // every plane is a sum, the counts are integers
+  const float* sums = static_cast<const float*>(state);
+  for (int i = 0; i < plane_ * (PLANES_ - 1); ++i) data_[i] += sums[i];
+  const int32_t* counts = reinterpret_cast<const int32_t*>(sums + plane_ * (PLANES_ - 1));
+  for (int i = 0; i < plane_; ++i) count_[i] += counts[i];
+}
+
+void Film::CopyPixel(const Film& from, int x_from, int y_from, int x, int y, int max_count) {
+  const int i = y * width_ + x, j = y_from * width_ + x_from;
+  const int count = from.count_[j];
+  const float scale = count > max_count ? float(max_count) / count : 1.0f;
+  // all planes but the last, which holds the counts
+  for (int p = 0; p + 1 < PLANES_; ++p) data_[p * plane_ + i] = from.data_[p * plane_ + j] * scale;
+  count_[i] = std::min(count, max_count);
+}
+
+Guide Film::MeanGuide(int x, int y) const {
+  const int i = y * width_ + x;
+  Guide guide;
+  if (!count_[i]) return guide;
+  const real inv = real(1) / count_[i];
+  for (int k = 0; k < 3; ++k) {
+    guide.albedo_[k] = albedo_[k][i] * inv;
+    guide.normal_[k] = normal_[k][i] * inv;
+  }
+  guide.depth_ = depth_[i] * inv;
+  return guide;
+}
+
+real Film::Variance(int x, int y) const {
+  const int i = y * width_ + x;
+  const int n = count_[i];
+  if (n < 2) return std::numeric_limits<real>::infinity();
+  const real mean = Luminance(Color(r_[i], g_[i], b_[i])) / n;
+  // sample variance, clamped against cancellation in the float sums
+  return std::max(real(0), (y2_[i] - mean * mean * n) / (n - 1)) / n;
+}
+
+real Film::Error(int x, int y) const {
+  const real mean = Luminance(Mean(x, y));
+  if (!(mean > 0)) return std::numeric_limits<real>::infinity();
+  return real(1.96) * std::sqrt(Variance(x, y)) / mean;
+}
+
+void Film::Resolve(int x0, int y0, int x1, int y1, unsigned char* rgba) const {
+  for (int y = y0; y < y1; ++y) {
+    const int i = y * width_ + x0;
+    ResolveSpan(r_ + i, g_ + i, b_ + i, count_ + i, x1 - x0, rgba + i * 4);
+  }
+}
+};  // namespace VCL
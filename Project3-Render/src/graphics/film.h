@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "common/mathtype.h"
+
+namespace VCL {
+// First hit features of a camera sample, the guides of the denoiser.
+struct Guide {
+  Color albedo_ = Color::Zero();
+  Vec3 normal_ = Vec3::Zero();
+  real depth_ = 0;
+};
+
+// Gamma corrects n pixels given as separate channel planes into the rgb
+// channels of RGBA pixels; alpha is left alone. With counts, each pixel is
+// divided by its count first and a count of 0 gives black.
+void ResolveSpan(const float* r, const float* g, const float* b, const int32_t* count, int n,
+                 unsigned char* rgba);
+
+// Accumulates samples per pixel as running sums, a sum of squared luminance
+// and a sample count, plus the sums of the samples' guides. The sums and the
+// counts are separate 64-byte aligned planes of one allocation, so resolving
+// walks them with SIMD loads.
+class Film {
+ public:
+  int width_;
+  int height_;
+
+  Film(int width, int height);
+  ~Film();
+  Film(const Film&) = delete;
+  Film& operator=(const Film&) = delete;
+
+  // drops all samples
+  void Reset();
+
+  void AddSample(int x, int y, const Color& c) {
+    const int i = y * width_ + x;
+    r_[i] += c[0];
+    g_[i] += c[1];
+    b_[i] += c[2];
+    const real lum = Luminance(c);
+    y2_[i] += lum * lum;
+    ++count_[i];
+  }
+  void AddSample(int x, int y, const Color& c, const Guide& guide) {
+    const int i = y * width_ + x;
+    for (int k = 0; k < 3; ++k) {
+      albedo_[k][i] += guide.albedo_[k];
+      normal_[k][i] += guide.normal_[k];
+    }
+    depth_[i] += guide.depth_;
+    AddSample(x, y, c);
+  }
+
+  int Count(int x, int y) const { return count_[y * width_ + x]; }
+
+  Color Mean(int x, int y) const {
+    const int i = y * width_ + x;
+    if (!count_[i]) return Color::Zero();
+    return Color(r_[i], g_[i], b_[i]) / real(count_[i]);
+  }
+
+  // zero without samples
+  Guide MeanGuide(int x, int y) const;
+
+  // Variance of the mean luminance, infinite below two samples.
+  real Variance(int x, int y) const;
+
+  // Half width of the 95% confidence interval of the mean luminance,
+  // relative to the mean. Infinite below two samples and while all samples
+  // were black, rare light paths may just not have been found yet.
+  real Error(int x, int y) const;
+
+  // The whole accumulated state as one block, for checkpoints. LoadState
+  // takes a block of StateSize() bytes from a film of the same size.
+  size_t StateSize() const;
+  const void* State() const { return data_; }
+  void LoadState(const void* state);
+  // Adds such a block, e.g. of a render of other samples of the same image.
+  void MergeState(const void* state);
+
+  // Copies the samples and guides of pixel (x_from, y_from) of a film of
+  // the same size to (x, y). Beyond max_count samples the sums are scaled
+  // down to that many, which keeps the means and the variance estimate.
+  void CopyPixel(const Film& from, int x_from, int y_from, int x, int y, int max_count);
+
+  // Writes the gamma corrected means of [x0, x1) x [y0, y1) to the rgb
+  // channels of an RGBA image of the film's size; alpha is left alone.
+  void Resolve(int x0, int y0, int x1, int y1, unsigned char* rgba) const;
+  void Resolve(unsigned char* rgba) const {
+    Resolve(0, 0, width_, height_, rgba);
+  }
+
+ private:
+  static real Luminance(const Color& c) {
+    return real(0.2126) * c[0] + real(0.7152) * c[1] + real(0.0722) * c[2];
+  }
+
+  int plane_;  // floats per plane, a multiple of 16
+  float* data_ = nullptr;
+  float* r_;
+  float* g_;
+  float* b_;
+  float* y2_;
+  float* albedo_[3];
+  float* normal_[3];
+  float* depth_;
+  int32_t* count_;
+};
+};  // namespace VCL
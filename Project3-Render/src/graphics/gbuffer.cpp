@@ -0,0 +1,80 @@
+#include "gbuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace VCL {
+namespace {
+real SignNotZero(real v) { return v < 0 ? real(-1) : real(1); }
+
+// unit vector to 2 x 16 bits, through the octahedron folded onto the plane
+uint32_t EncodeNormal(const Vec3& n) {
+  const real l1 = std::abs(n[0]) + std::abs(n[1]) + std::abs(n[2]);
+  real u = n[0] / l1, v = n[1] / l1;
+  if (n[2] < 0) {
+    const real fu = (1 - std::abs(v)) * SignNotZero(u);
+    v = (1 - std::abs(u)) * SignNotZero(v);
+    u = fu;
+  }
+  const auto quantize = [](real x) {
+    return uint32_t(uint16_t(int16_t(std::lround(std::clamp(x, real(-1), real(1)) * 32767))));
+  };
+  return quantize(u) | quantize(v) << 16;
+}
+
+Vec3 DecodeNormal(uint32_t packed) {
+  real u = int16_t(packed & 0xffff) / real(32767);
+  real v = int16_t(packed >> 16) / real(32767);
+  const real w = 1 - std::abs(u) - std::abs(v);
+  if (w < 0) {
+    const real fu = (1 - std::abs(v)) * SignNotZero(u);
+    v = (1 - std::abs(u)) * SignNotZero(v);
+    u = fu;
+  }
+  return Vec3(u, v, w).normalized();
+}
+}  // namespace
+
+Vec2 GBuffer::Jitter(int jitter, const Vec2& offset) {
+  // radical inverse in base 2 of the low bits
+  uint32_t bits = 0;
+  for (int b = 1, r = JITTERS_ / 2; b < JITTERS_; b <<= 1, r >>= 1) {
+    if (jitter & b) bits |= r;
+  }
+  const Vec2 p(real(jitter + real(0.5)) / JITTERS_, real(bits) / JITTERS_);
+  Vec2 u = p + offset;
+  for (int k = 0; k < 2; ++k) {
+    if (u[k] >= 1) u[k] -= 1;
+  }
+  return u;
+}
+
+GBuffer::GBuffer(int width, int height) : entries_(size_t(width) * height * JITTERS_) {
+  Invalidate();
+}
+
+void GBuffer::Invalidate() { std::fill(entries_.begin(), entries_.end(), Entry{-1, 0, nullptr, nullptr, -1}); }
+
+bool GBuffer::Lookup(int pixel, int jitter, const Ray& ray, HitRecord& hit) const {
+  const Entry& e = entries_[size_t(pixel) * JITTERS_ + jitter];
+  if (e.t_ < 0) return false;
+  hit.t_ = e.t_;
+  hit.obj_ = e.obj_;
+  hit.face_ = e.face_;
+  if (!e.obj_) return true;
+  hit.mat_ = e.mat_;
+  hit.pos_ = ray.ori_ + ray.dir_ * e.t_;
+  hit.n_ = DecodeNormal(e.normal_);
+  return true;
+}
+
+void GBuffer::Store(int pixel, int jitter, const HitRecord& hit) {
+  Entry& e = entries_[size_t(pixel) * JITTERS_ + jitter];
+  e.obj_ = hit.obj_;
+  e.t_ = hit.obj_ ? float(hit.t_) : std::numeric_limits<float>::infinity();
+  e.normal_ = hit.obj_ ? EncodeNormal(hit.n_) : 0;
+  e.mat_ = hit.obj_ ? hit.mat_ : nullptr;
+  e.face_ = hit.obj_ ? hit.face_ : -1;
+}
+};  // namespace VCL
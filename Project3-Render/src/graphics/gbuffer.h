@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "graphics/object.h"
+
+namespace VCL {
+// First hits of the camera rays through JITTERS_ fixed sub-pixel positions
+// per pixel. Progressive rendering cycles through the positions, so after
+// the first JITTERS_ passes no camera ray needs to be intersected again.
+// Only valid while the camera and the scene stay put, Invalidate() on any
+// change of either.
+// Edges are antialiased with the JITTERS_ positions only, however many
+// samples a pixel takes.
+class GBuffer {
+ public:
+  static constexpr int JITTERS_ = 8;
+
+  GBuffer(int width, int height);
+
+  // Sub-pixel position of a jitter index, a Hammersley set shifted by a per
+  // pixel offset in [0, 1)^2 so that the positions stay stratified.
+  static Vec2 Jitter(int jitter, const Vec2& offset);
+
+  void Invalidate();
+
+  // Fills hit with the cached first hit of ray, the camera ray through the
+  // given jitter position of pixel, and returns whether it was cached.
+  // A cached miss leaves hit.obj_ null.
+  bool Lookup(int pixel, int jitter, const Ray& ray, HitRecord& hit) const;
+  void Store(int pixel, int jitter, const HitRecord& hit);
+
+ private:
+  // obj_->Mat() is not the hit's material for an Instance, so material
+  // and face are kept as well
+  struct Entry {
+    float t_;  // negative when not cached
+    uint32_t normal_;  // octahedral, 16 bits per coordinate
+    const Object* obj_;
+    const Material* mat_;
+    int32_t face_;
+  };
+
+  std::vector<Entry> entries_;
+};
+};  // namespace VCL
@@ -1,8 +1,9 @@
 #include "globillum.h"
 
-#include "common/helperfunc.h"
 #include "light.h"
+#include "common/stats.h"
 
+#include <algorithm>
 #include <iostream>
 
 namespace VCL::GlobIllum {
@@ -16,100 +17,212 @@ Vec3 AxisAngle(const Vec3 &w, const real cos2theta, const real phi)
 	return (u * std::cos(phi) * sin_theta + v * std::sin(phi) * sin_theta + w * cos_theta).normalized();
 }
 
-Vec3 Sample(const Material *const mat, const Vec3 &n, const Vec3 &wi, Color &weight)
+// Probability of sampling the diffuse lobe.
+real DiffuseProb(const Material *const mat)
 {
-  const real R = mat->k_d_.mean() / (mat->k_d_.mean() + mat->k_s_.mean());
-  const real r0 = rand01();
-  if (r0 < R) { // sample diffuse ray
-    weight = mat->k_d_.any() ? mat->k_d_ / R : Color(0, 0, 0);
-    return AxisAngle(n, rand01(), rand01() * 2 * PI_);
+  return mat->k_d_.mean() / (mat->k_d_.mean() + mat->k_s_.mean());
+}
+
+// BSDF times the cosine at wo, for the lobes that are not ideal mirrors, and
+// the density with which Sample() picks wo through those lobes.
+Color Eval(const Material *const mat, const Vec3 &n, const Vec3 &wi, const Vec3 &wo, real &pdf)
+{
+  const real R = DiffuseProb(mat);
+  const real cos_o = n.dot(wo);
+  Color f(0, 0, 0);
+  pdf = 0;
+  if (cos_o > 0) {
+    pdf += R * cos_o / PI_;
+    f += mat->k_d_ * cos_o / PI_;
   }
-  else { // sample specular ray
-    if (mat->alpha_ >= 0) {
-      const Vec3 d = AxisAngle(n * 2 * n.dot(wi) - wi, std::pow(rand01(), real(2) / (mat->alpha_ + 2)), rand01() * 2 * PI_);
-      weight = n.dot(d) <= 0 || !mat->k_s_.any() ? Color(0, 0, 0) : mat->k_s_ / (1 - R);
-      return d;
-    }
-    else { // for ideal mirrors
-      weight = mat->k_s_.any() ? mat->k_s_ / (1 - R) : Color(0, 0, 0);
-      return n * 2 * n.dot(wi) - wi;
+  if (mat->alpha_ >= 0) {
+    // the specular lobe samples cos^(alpha+1) around the reflection
+    const real c = (n * 2 * n.dot(wi) - wi).dot(wo);
+    if (c > 0) {
+      const real lobe = (mat->alpha_ + 2) / (2 * PI_) * std::pow(c, mat->alpha_ + 1);
+      pdf += (1 - R) * lobe;
+      if (cos_o > 0) f += mat->k_s_ * lobe;
     }
   }
+  return f;
+}
+
+Vec3 Sample(const Material *const mat, const Vec3 &n, const Vec3 &wi, Color &weight, real &pdf, Sampler &sampler)
+{
+  const real R = DiffuseProb(mat);
+  const real r0 = sampler.Next1D();
+  Vec3 d;
+  if (r0 < R) { // sample diffuse ray
+    const Vec2 u = sampler.Next2D();
+    d = AxisAngle(n, u[0], u[1] * 2 * PI_);
+  }
+  else if (mat->alpha_ >= 0) { // sample specular ray
+    const Vec2 u = sampler.Next2D();
+    d = AxisAngle(n * 2 * n.dot(wi) - wi, std::pow(u[0], real(2) / (mat->alpha_ + 2)), u[1] * 2 * PI_);
+  }
+  else { // for ideal mirrors
+    pdf = 0;
+    weight = mat->k_s_.any() ? mat->k_s_ / (1 - R) : Color(0, 0, 0);
+    return n * 2 * n.dot(wi) - wi;
+  }
+  const Color f = Eval(mat, n, wi, d, pdf);
+  weight = pdf > 0 ? Color(f / pdf) : Color(0, 0, 0);
+  return d;
+}
+
+real PowerHeuristic(const real a, const real b)
+{
+  return a * a / (a * a + b * b);
+}
+
+// Decides whether a path with the given number of vertices goes on, and
+// scales the throughput of survivors so the estimate stays unbiased.
+bool Survive(Color &throughput, const int depth, const TraceParams &params, Sampler &sampler)
+{
+  const real m = throughput.maxCoeff();
+  if (!(m > 0)) {
+    VCL_STAT_PATH(Absorbed, depth);
+    return false;
+  }
+  if (depth >= params.max_depth_) {
+    VCL_STAT_PATH(Depth, depth);
+    return false;
+  }
+  if (depth < params.rr_depth_ && m >= params.min_throughput_) return true;
+  const real q = std::min(real(1), m);
+  if (sampler.Next1D() >= q) {
+    VCL_STAT_PATH(Roulette, depth);
+    return false;
+  }
+  throughput /= q;
+  return true;
+}
+
+Color RayTrace(const Scene &scene, Ray ray, Sampler &sampler, const TraceParams &params)
+{
+  HitRecord hit;
+  if (!scene.Intersect(ray, hit)) {
+    VCL_STAT_PATH(Escaped, 0);
+    return Color(0, 0, 0);
+  }
+  return RayTrace(scene, ray, hit, sampler, params);
 }
 
-Color RayTrace(const Scene &scene, Ray ray)
+Color RayTrace(const Scene &scene, Ray ray, HitRecord hit, Sampler &sampler, const TraceParams &params)
 {
   Color color(0, 0, 0);
   Color weight(1, 1, 1);
-  std::vector<Light> lights;
-
-  for (int depth = 0; depth < 10; depth++) {
-    Vec3 pos;
-    const Object *obj = scene.Intersect(ray, pos);
-    lights.clear();
-    if (!obj) return color;
-    auto mat = obj->Mat();
-    const Vec3 n = obj->ClosestNormal(pos);
-
-    // Lights
-    for (const auto& tlight : scene.lights_) {
-      Vec3 test_pos;
-      const Ray test_ray(pos + 0.01 * (tlight->position - pos), (tlight->position - pos).normalized());
-      const Object * test_obj = scene.Intersect(test_ray, test_pos);
-      if (test_obj && test_obj->Mat()->emissive_) {
-        lights.push_back(*tlight);
+
+  for (int depth = 0;; depth++) {
+    if (depth > 0) {
+      VCL_STAT(BounceRays, 1);
+      if (!scene.Intersect(ray, hit)) {
+        VCL_STAT_PATH(Escaped, depth);
+        return color;
       }
     }
+    const Vec3 &pos = hit.pos_;
+    auto mat = hit.mat_;
+    const Vec3 &n = hit.n_;
 
-    // Phong shading
+    // Phong shading, lights blocked before their position are skipped
     Color result(0, 0, 0);
     result += mat->k_d_ * scene.ambient_light_;
-    for (const auto light : lights) {
-      real f = 1.0 / (pos - light.position).dot(pos - light.position);
-      Vec3 l = (light.position - pos).normalized();
-      result += (f * mat->k_d_ * light.intensity * (n.dot(l) > 0 ? n.dot(l) : 0));
+    for (const auto &light : scene.lights_) {
+      const Vec3 to_light = light->position - pos;
+      const real dist2 = to_light.squaredNorm();
+      const real dist = std::sqrt(dist2);
+      const Vec3 l = to_light / dist;
+      // stop just short of the light, which may sit on a wall
+      const Ray test_ray(pos + 0.01 * to_light, l);
+      if (scene.Occluded(test_ray, real(0.99) * dist - real(1e-4))) continue;
+
+      real f = 1 / dist2;
+      result += (f * mat->k_d_ * light->intensity * (n.dot(l) > 0 ? n.dot(l) : 0));
       Vec3 h = (-ray.dir_ + l).normalized();
-      result += (f * mat->k_s_ * light.intensity * std::pow((n.dot(h) > 0 ? n.dot(h) : 0), mat->alpha_));
+      result += (f * mat->k_s_ * light->intensity * std::pow((n.dot(h) > 0 ? n.dot(h) : 0), mat->alpha_));
     }
 
     // accumulate color
     Color R = mat->k_s_ * 0.5;
     color += weight * (Color(1, 1, 1) - R) * result;
     weight *= R;
+    // diffuse surfaces have no k_s_, so most paths end at the first hit
+    if (!Survive(weight, depth + 1, params, sampler)) return color;
 
     // generate new ray
     real cos_theta = -n.dot(ray.dir_);
     Vec3 dir = 2 * cos_theta * n + ray.dir_;
     ray = Ray(pos + 0.01 * dir, dir.normalized());
   }
-
-  return color;
 }
 
-Color PathTrace(const Scene &scene, Ray ray)
+Color PathTrace(const Scene &scene, Ray ray, Sampler &sampler, const TraceParams &params)
 {
-  Color color(1, 1, 1);
+  HitRecord hit;
+  if (!scene.Intersect(ray, hit)) {
+    VCL_STAT_PATH(Escaped, 0);
+    return Color(0, 0, 0);
+  }
+  return PathTrace(scene, ray, hit, sampler, params);
+}
 
-  for (int depth = 0; depth < 10; depth++) {
-    Vec3 pos;
-    const Object *obj = scene.Intersect(ray, pos);
-    if (!obj) {
-      return Color(0, 0, 0);
+Color PathTrace(const Scene &scene, Ray ray, HitRecord hit, Sampler &sampler, const TraceParams &params)
+{
+  Color color(0, 0, 0);
+  Color throughput(1, 1, 1);
+  // pdf of the bounce that led here, 0 if light sampling could not have found it
+  real bsdf_pdf = 0;
+  Vec3 last_pos;
+
+  for (int depth = 0;; depth++) {
+    if (depth > 0) {
+      VCL_STAT(BounceRays, 1);
+      if (!scene.Intersect(ray, hit)) {
+        VCL_STAT_PATH(Escaped, depth);
+        return color;
+      }
     }
-    if (obj->Mat()->emissive_) {
-      return (color * obj->Mat()->k_d_);
+    const Material *mat = hit.mat_;
+    if (mat->emissive_) {
+      real w = 1;
+      if (bsdf_pdf > 0) {
+        const real light_pdf = scene.EmitterPdf(hit.obj_) * hit.obj_->SurfacePdf(last_pos, hit);
+        w = PowerHeuristic(bsdf_pdf, light_pdf);
+      }
+      VCL_STAT_PATH(Emissive, depth + 1);
+      return color + throughput * mat->k_d_ * w;
     }
 
-    Color weight(0, 0, 0);
-    Vec3 dir = Sample(obj->Mat(), obj->ClosestNormal(pos), -ray.dir_, weight);
-    if (!weight.any()) return weight;
-    else {
-      color *= (weight * obj->ClosestNormal(pos).dot(-ray.dir_)); 
-      ray = Ray(pos + 0.01 * dir, dir.normalized());
+    const Vec3 wi = -ray.dir_;
+    const real cos_i = hit.n_.dot(wi);
+
+    // next-event estimation
+    real emitter_pdf;
+    const Object *emitter = scene.SampleEmitter(sampler.Next1D(), emitter_pdf);
+    const Vec2 u = sampler.Next2D();
+    Vec3 light_pos;
+    const real dir_pdf = emitter ? emitter->SampleSurface(hit.pos_, u, light_pos) : 0;
+    // parts of an emitter outside the room can't be hit by BSDF rays either
+    if (dir_pdf > 0 && Scene::InRoom(light_pos)) {
+      const Vec3 to_light = light_pos - hit.pos_;
+      const real dist = to_light.norm();
+      const Vec3 wo = to_light / dist;
+      real pdf;
+      const Color f = Eval(mat, hit.n_, wi, wo, pdf);
+      if (f.any() && !scene.Occluded(Ray(hit.pos_ + 0.01 * wo, wo), (dist - real(0.01)) * real(0.999))) {
+        const real light_pdf = emitter_pdf * dir_pdf;
+        color += throughput * cos_i * f * emitter->Mat()->k_d_ * (PowerHeuristic(light_pdf, pdf) / light_pdf);
+      }
     }
-  }
 
-  return Color(0, 0, 0);
+    Color weight(0, 0, 0);
+    Vec3 dir = Sample(mat, hit.n_, wi, weight, bsdf_pdf, sampler);
+    throughput *= weight * cos_i;
+    if (!Survive(throughput, depth + 1, params, sampler)) return color;
+    last_pos = hit.pos_;
+    ray = Ray(hit.pos_ + 0.01 * dir, dir.normalized());
+  }
 }
 
 }
\ No newline at end of file
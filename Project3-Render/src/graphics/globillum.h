@@ -1,8 +1,37 @@
+#pragma once
+
+#include "common/sampler.h"
 #include "graphics/scene.h"
 
 namespace VCL::GlobIllum {
 
-Color RayTrace(const Scene &scene, Ray ray);
-Color PathTrace(const Scene &scene, Ray ray);
+// When paths end. A path has at most max_depth_ vertices; from rr_depth_
+// vertices on, or once its throughput drops below min_throughput_, it plays
+// Russian roulette with its throughput as survival probability.
+struct TraceParams
+{
+  int max_depth_ = 10;
+  int rr_depth_ = 3;
+  real min_throughput_ = real(0.05);
+};
+
+// Samples a direction from one lobe of mat. weight is BSDF * cosine / pdf,
+// and pdf is 0 after an ideal mirror reflection.
+Vec3 Sample(const Material *const mat, const Vec3 &n, const Vec3 &wi, Color &weight, real &pdf, Sampler &sampler);
+
+// BSDF times cosine at wo and the density of Sample() picking wo.
+Color Eval(const Material *const mat, const Vec3 &n, const Vec3 &wi, const Vec3 &wo, real &pdf);
+
+real PowerHeuristic(const real a, const real b);
+
+// Whether a path of depth vertices goes on, see TraceParams.
+bool Survive(Color &throughput, const int depth, const TraceParams &params, Sampler &sampler);
+
+Color RayTrace(const Scene &scene, Ray ray, Sampler &sampler, const TraceParams &params = TraceParams());
+Color PathTrace(const Scene &scene, Ray ray, Sampler &sampler, const TraceParams &params = TraceParams());
+
+// Continue from an already found first hit of ray, e.g. from a packet.
+Color RayTrace(const Scene &scene, Ray ray, HitRecord hit, Sampler &sampler, const TraceParams &params = TraceParams());
+Color PathTrace(const Scene &scene, Ray ray, HitRecord hit, Sampler &sampler, const TraceParams &params = TraceParams());
 
 }
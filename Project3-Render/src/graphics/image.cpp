@@ -1,5 +1,8 @@
 #include "image.h"
 
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
 namespace VCL {
 Image::Image(int width, int height, int channels) {
   width_ = width;
@@ -8,4 +11,14 @@ Image::Image(int width, int height, int channels) {
   int num_elems = width * height * channels;
   buffer_ = new unsigned char[num_elems];
 }
-};
\ No newline at end of file
+
+bool WritePNG(const std::string& path, int width, int height,
+              const unsigned char* rgba) {
+  return stbi_write_png(path.c_str(), width, height, 4, rgba, width * 4) != 0;
+}
+
+bool WriteHDR(const std::string& path, int width, int height,
+              const float* rgb) {
+  return stbi_write_hdr(path.c_str(), width, height, 3, rgb) != 0;
+}
+};
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string>
+
 namespace VCL {
 class Image {
  public:
@@ -14,4 +16,11 @@ class Image {
     if (buffer_) delete[] buffer_;
   }
 };
-}  // namespace VCL
\ No newline at end of file
+
+// 8-bit RGBA, rows top-down
+bool WritePNG(const std::string& path, int width, int height,
+              const unsigned char* rgba);
+// linear float RGB, rows top-down
+bool WriteHDR(const std::string& path, int width, int height,
+              const float* rgb);
+}  // namespace VCL
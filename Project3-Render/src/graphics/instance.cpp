@@ -0,0 +1,53 @@
+#include "instance.h"
+
+namespace VCL {
+
+Prototype::Prototype(std::vector<std::unique_ptr<Object>> objs) :
+  objs_(std::move(objs))
+{
+  std::vector<AABB> bounds;
+  bounds.reserve(objs_.size());
+  for (const auto &obj : objs_) bounds.push_back(obj->Bounds());
+  bvh_.Build(bounds);
+}
+
+bool Prototype::Intersect(const Ray &ray, const real tmax, HitRecord &hit) const
+{
+  real t = tmax;
+  bool found = false;
+  bvh_.Traverse(ray, t, [&](const int i, real &nearest) {
+    if (objs_[i]->Intersect(ray, nearest, hit)) nearest = hit.t_, found = true;
+    return false;
+  });
+  return found;
+}
+
+Instance::Instance(std::shared_ptr<const Prototype> proto, const Mat4 &transform) :
+  Object(proto->Objects().front()->Mat()),
+  proto_(std::move(proto)),
+  to_object_(transform.inverse().topRows<3>())
+{
+  const AABB box = proto_->Bounds();
+  for (int corner = 0; corner < 8; ++corner) {
+    const Vec3 p((corner & 1 ? box.max_ : box.min_)[0], (corner & 2 ? box.max_ : box.min_)[1],
+                 (corner & 4 ? box.max_ : box.min_)[2]);
+    bounds_.Extend((transform * p.homogeneous()).head<3>());
+  }
+}
+
+bool Instance::Intersect(const Ray &ray, const real tmax, HitRecord &hit) const
+{
+  // distances along the unit direction in object space are scale times
+  // those in the scene
+  const Vec3 dir = to_object_.leftCols<3>() * ray.dir_;
+  const real scale = dir.norm();
+  if (!proto_->Intersect(Ray(to_object_ * ray.ori_.homogeneous(), dir), tmax * scale, hit)) return false;
+  hit.t_ /= scale;
+  hit.pos_ = ray.ori_ + ray.dir_ * hit.t_;
+  // normals go by the inverse transpose
+  hit.n_ = (to_object_.leftCols<3>().transpose() * hit.n_).normalized();
+  hit.obj_ = this;
+  return true;
+}
+
+}
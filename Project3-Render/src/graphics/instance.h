@@ -0,0 +1,57 @@
+#pragma once
+
+#include "graphics/bvh.h"
+#include "graphics/object.h"
+
+#include <memory>
+#include <vector>
+
+namespace VCL {
+
+// Geometry shared by any number of Instances: bounded primitives or meshes
+// in object space, each with its own material, and a BVH over them. Their
+// materials must not be emissive, emitters are sampled as objects of the
+// scene.
+class Prototype
+{
+protected:
+
+  std::vector<std::unique_ptr<Object>> objs_;
+  BVH bvh_;
+
+public:
+
+  explicit Prototype(std::vector<std::unique_ptr<Object>> objs);
+
+  const std::vector<std::unique_ptr<Object>> &Objects() const { return objs_; }
+
+  AABB Bounds() const { return bvh_.Empty() ? AABB() : bvh_.nodes_[0].box_; }
+
+  bool Intersect(const Ray &ray, const real tmax, HitRecord &hit) const;
+};
+
+// A prototype placed in the scene by an affine transform. Rays are taken
+// into object space, so an instance costs a transform and a box however
+// large its prototype is. Hits keep the material and face of the prototype
+// object that was hit; Mat() is that of the first one.
+class Instance final : public Object
+{
+protected:
+
+  std::shared_ptr<const Prototype> proto_;
+  Eigen::Matrix<real, 3, 4> to_object_;
+  AABB bounds_;
+
+public:
+
+  // transform takes object space to the scene and must be invertible
+  Instance(std::shared_ptr<const Prototype> proto, const Mat4 &transform);
+
+  virtual ~Instance() = default;
+
+  virtual bool Intersect(const Ray &ray, const real tmax, HitRecord &hit) const override;
+
+  virtual AABB Bounds() const override { return bounds_; }
+};
+
+}
@@ -0,0 +1,57 @@
+// AVX2 batch kernels. Built with AVX2 enabled and called only on CPUs that
+// have it, see graphics/batch.cpp.
+
+#include <immintrin.h>
+
+#include "graphics/batchkernels.h"
+
+namespace VCL {
+namespace {
+
+struct V
+{
+  static constexpr int WIDTH_ = 8;
+
+  struct M
+  {
+    __m256 m_;
+    friend M operator&(M a, M b) { return M{_mm256_and_ps(a.m_, b.m_)}; }
+    friend int Bits(M a) { return _mm256_movemask_ps(a.m_); }
+  };
+
+  __m256 v_;
+  V() = default;
+  explicit V(__m256 v) : v_(v) { }
+  V(float x) : v_(_mm256_set1_ps(x)) { }
+  static V Load(const float *p) { return V(_mm256_load_ps(p)); }
+  friend V operator+(V a, V b) { return V(_mm256_add_ps(a.v_, b.v_)); }
+  friend V operator-(V a, V b) { return V(_mm256_sub_ps(a.v_, b.v_)); }
+  friend V operator*(V a, V b) { return V(_mm256_mul_ps(a.v_, b.v_)); }
+  friend V operator/(V a, V b) { return V(_mm256_div_ps(a.v_, b.v_)); }
+  friend V operator-(V a) { return V(_mm256_xor_ps(a.v_, _mm256_set1_ps(-0.0f))); }
+  friend M operator<(V a, V b) { return M{_mm256_cmp_ps(a.v_, b.v_, _CMP_LT_OQ)}; }
+  friend M operator<=(V a, V b) { return M{_mm256_cmp_ps(a.v_, b.v_, _CMP_LE_OQ)}; }
+  friend M operator>(V a, V b) { return M{_mm256_cmp_ps(a.v_, b.v_, _CMP_GT_OQ)}; }
+  friend M operator>=(V a, V b) { return M{_mm256_cmp_ps(a.v_, b.v_, _CMP_GE_OQ)}; }
+  // like std::min / std::max, a NaN in b yields a
+  friend V Min(V a, V b) { return V(_mm256_min_ps(b.v_, a.v_)); }
+  friend V Max(V a, V b) { return V(_mm256_max_ps(b.v_, a.v_)); }
+  friend V Sqrt(V a) { return V(_mm256_sqrt_ps(a.v_)); }
+  friend V Select(M m, V a, V b) { return V(_mm256_blendv_ps(b.v_, a.v_, m.m_)); }
+  friend float HMin(V a)
+  {
+    __m256 m = _mm256_min_ps(a.v_, _mm256_permute2f128_ps(a.v_, a.v_, 1));
+    m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm256_cvtss_f32(m);
+  }
+};
+
+}
+
+float IntersectBatchAVX2(const PrimBatch &batch, const BatchRay &ray, float tmax, bool occluders, int &lane)
+{
+  return BatchKernel::Closest<V>(batch, ray, tmax, occluders, lane);
+}
+
+}
@@ -0,0 +1,56 @@
+// SSE4.1 batch kernels, two 4-wide halves per batch. Built with SSE4.1
+// enabled and called only on CPUs that have it, see graphics/batch.cpp.
+
+#include <smmintrin.h>
+
+#include "graphics/batchkernels.h"
+
+namespace VCL {
+namespace {
+
+struct V
+{
+  static constexpr int WIDTH_ = 4;
+
+  struct M
+  {
+    __m128 m_;
+    friend M operator&(M a, M b) { return M{_mm_and_ps(a.m_, b.m_)}; }
+    friend int Bits(M a) { return _mm_movemask_ps(a.m_); }
+  };
+
+  __m128 v_;
+  V() = default;
+  explicit V(__m128 v) : v_(v) { }
+  V(float x) : v_(_mm_set1_ps(x)) { }
+  static V Load(const float *p) { return V(_mm_load_ps(p)); }
+  friend V operator+(V a, V b) { return V(_mm_add_ps(a.v_, b.v_)); }
+  friend V operator-(V a, V b) { return V(_mm_sub_ps(a.v_, b.v_)); }
+  friend V operator*(V a, V b) { return V(_mm_mul_ps(a.v_, b.v_)); }
+  friend V operator/(V a, V b) { return V(_mm_div_ps(a.v_, b.v_)); }
+  friend V operator-(V a) { return V(_mm_xor_ps(a.v_, _mm_set1_ps(-0.0f))); }
+  friend M operator<(V a, V b) { return M{_mm_cmplt_ps(a.v_, b.v_)}; }
+  friend M operator<=(V a, V b) { return M{_mm_cmple_ps(a.v_, b.v_)}; }
+  friend M operator>(V a, V b) { return M{_mm_cmpgt_ps(a.v_, b.v_)}; }
+  friend M operator>=(V a, V b) { return M{_mm_cmpge_ps(a.v_, b.v_)}; }
+  // like std::min / std::max, a NaN in b yields a
+  friend V Min(V a, V b) { return V(_mm_min_ps(b.v_, a.v_)); }
+  friend V Max(V a, V b) { return V(_mm_max_ps(b.v_, a.v_)); }
+  friend V Sqrt(V a) { return V(_mm_sqrt_ps(a.v_)); }
+  friend V Select(M m, V a, V b) { return V(_mm_blendv_ps(b.v_, a.v_, m.m_)); }
+  friend float HMin(V a)
+  {
+    __m128 m = _mm_min_ps(a.v_, _mm_shuffle_ps(a.v_, a.v_, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(m);
+  }
+};
+
+}
+
+float IntersectBatchSSE4(const PrimBatch &batch, const BatchRay &ray, float tmax, bool occluders, int &lane)
+{
+  return BatchKernel::Closest<V>(batch, ray, tmax, occluders, lane);
+}
+
+}
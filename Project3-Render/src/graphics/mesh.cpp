@@ -0,0 +1,176 @@
+#include "mesh.h"
+
+#include <spdlog/spdlog.h>
+
+#include <fstream>
+#include <sstream>
+
+namespace VCL {
+
+namespace {
+
+// Per-ray setup of the watertight ray/triangle test (Woop, Benthin and Wald,
+// JCGT 2013): vertices are translated to the ray origin and sheared so the
+// ray runs along +z, which makes the edge tests exact on shared edges.
+struct RayShear
+{
+  Vec3 ori;
+  int kx, ky, kz;
+  real sx, sy, sz;
+
+  explicit RayShear(const Ray &ray) : ori(ray.ori_)
+  {
+    ray.dir_.cwiseAbs().maxCoeff(&kz);
+    kx = (kz + 1) % 3;
+    ky = (kx + 1) % 3;
+    if (ray.dir_[kz] < 0) std::swap(kx, ky);
+    sx = ray.dir_[kx] / ray.dir_[kz];
+    sy = ray.dir_[ky] / ray.dir_[kz];
+    sz = 1 / ray.dir_[kz];
+  }
+};
+
+// Distance along the ray to a front-facing hit, or infinity.
+inline real IntersectTriangle(const RayShear &r, const Vec3 &v0, const Vec3 &v1, const Vec3 &v2)
+{
+  const Vec3 a = v0 - r.ori, b = v1 - r.ori, c = v2 - r.ori;
+  const real ax = a[r.kx] - r.sx * a[r.kz], ay = a[r.ky] - r.sy * a[r.kz];
+  const real bx = b[r.kx] - r.sx * b[r.kz], by = b[r.ky] - r.sy * b[r.kz];
+  const real cx = c[r.kx] - r.sx * c[r.kz], cy = c[r.ky] - r.sy * c[r.kz];
+
+  real u = cx * by - cy * bx;
+  real v = ax * cy - ay * cx;
+  real w = bx * ay - by * ax;
+  if (u == 0 || v == 0 || w == 0) { // fall back to double precision on edges
+    u = real(double(cx) * by - double(cy) * bx);
+    v = real(double(ax) * cy - double(ay) * cx);
+    w = real(double(bx) * ay - double(by) * ax);
+  }
+  // back faces are culled like the faces of the other primitives
+  if (u < 0 || v < 0 || w < 0) return std::numeric_limits<real>::infinity();
+  const real det = u + v + w;
+  if (det <= 0) return std::numeric_limits<real>::infinity();
+
+  const real t = (u * r.sz * a[r.kz] + v * r.sz * b[r.kz] + w * r.sz * c[r.kz]) / det;
+  return t > EPS_ ? t : std::numeric_limits<real>::infinity();
+}
+
+}
+
+TriangleMesh::TriangleMesh(const Material *const mat, const std::vector<Vec3> &vertices, const std::vector<Vec3i> &triangles) :
+  Object(mat)
+{
+  vx_.reserve(vertices.size());
+  vy_.reserve(vertices.size());
+  vz_.reserve(vertices.size());
+  for (const auto &v : vertices) {
+    vx_.push_back(v[0]);
+    vy_.push_back(v[1]);
+    vz_.push_back(v[2]);
+  }
+
+  std::vector<AABB> bounds;
+  bounds.reserve(triangles.size());
+  for (const auto &tri : triangles) {
+    const Vec3 n = (Vertex(tri[1]) - Vertex(tri[0])).cross(Vertex(tri[2]) - Vertex(tri[0]));
+    if (!(n.squaredNorm() > 0)) continue; // degenerate
+    i0_.push_back(tri[0]);
+    i1_.push_back(tri[1]);
+    i2_.push_back(tri[2]);
+    const Vec3 nn = n.normalized();
+    nx_.push_back(nn[0]);
+    ny_.push_back(nn[1]);
+    nz_.push_back(nn[2]);
+
+    AABB box;
+    for (int k = 0; k < 3; ++k) box.Extend(Vertex(tri[k]));
+    // keep axis-aligned triangles from producing zero-width slabs
+    box.min_ -= Vec3::Constant(real(1e-5));
+    box.max_ += Vec3::Constant(real(1e-5));
+    bounds.push_back(box);
+  }
+  bvh_.Build(bounds);
+}
+
+TriangleMesh::TriangleMesh(const Material *const mat, const Arrays &arrays) :
+  Object(mat),
+  vx_(arrays.vx_, arrays.vx_ + arrays.vertices_),
+  vy_(arrays.vy_, arrays.vy_ + arrays.vertices_),
+  vz_(arrays.vz_, arrays.vz_ + arrays.vertices_),
+  i0_(arrays.i0_, arrays.i0_ + arrays.triangles_),
+  i1_(arrays.i1_, arrays.i1_ + arrays.triangles_),
+  i2_(arrays.i2_, arrays.i2_ + arrays.triangles_),
+  nx_(arrays.nx_, arrays.nx_ + arrays.triangles_),
+  ny_(arrays.ny_, arrays.ny_ + arrays.triangles_),
+  nz_(arrays.nz_, arrays.nz_ + arrays.triangles_)
+{
+  // every triangle is in exactly one leaf
+  bvh_.nodes_.assign(arrays.nodes_, arrays.nodes_ + arrays.nodes_count_);
+  bvh_.indices_.assign(arrays.indices_, arrays.indices_ + arrays.triangles_);
+}
+
+TriangleMesh::Arrays TriangleMesh::GetArrays() const
+{
+  return Arrays{vx_.data(), vy_.data(), vz_.data(), int(vx_.size()),
+                i0_.data(), i1_.data(), i2_.data(), nx_.data(), ny_.data(), nz_.data(), int(i0_.size()),
+                bvh_.nodes_.data(), int(bvh_.nodes_.size()), bvh_.indices_.data()};
+}
+
+std::unique_ptr<TriangleMesh> TriangleMesh::LoadOBJ(const Material *const mat, const std::string &path, const Mat4 &transform)
+{
+  std::ifstream file(path);
+  if (!file) {
+    spdlog::error("cannot open mesh {}", path);
+    return nullptr;
+  }
+
+  std::vector<Vec3> vertices;
+  std::vector<Vec3i> triangles;
+  std::string line, tag;
+  while (std::getline(file, line)) {
+    std::istringstream in(line);
+    if (!(in >> tag)) continue;
+    if (tag == "v") {
+      Vec4 p(0, 0, 0, 1);
+      in >> p[0] >> p[1] >> p[2];
+      vertices.push_back((transform * p).head<3>());
+    }
+    else if (tag == "f") {
+      std::vector<int> face;
+      std::string vert;
+      while (in >> vert) { // v, v/vt, v//vn or v/vt/vn, negative is relative
+        const int i = std::atoi(vert.c_str());
+        if (i == 0) {
+          spdlog::error("mesh {} has a malformed face: {}", path, line);
+          return nullptr;
+        }
+        face.push_back(i < 0 ? int(vertices.size()) + i : i - 1);
+      }
+      for (int k = 2; k < int(face.size()); ++k) triangles.emplace_back(face[0], face[k - 1], face[k]);
+    }
+  }
+
+  for (const auto &tri : triangles) {
+    if (tri.minCoeff() < 0 || tri.maxCoeff() >= int(vertices.size())) {
+      spdlog::error("mesh {} has an out of range vertex index", path);
+      return nullptr;
+    }
+  }
+  spdlog::info("loaded mesh {}: {} vertices, {} triangles", path, vertices.size(), triangles.size());
+  return std::make_unique<TriangleMesh>(mat, vertices, triangles);
+}
+
+bool TriangleMesh::Intersect(const Ray &ray, const real tmax, HitRecord &hit) const
+{
+  const RayShear shear(ray);
+  real t = tmax;
+  int face = -1;
+  bvh_.Traverse(ray, t, [&](const int f, real &nearest) {
+    const real temp = IntersectTriangle(shear, Vertex(i0_[f]), Vertex(i1_[f]), Vertex(i2_[f]));
+    if (temp < nearest) nearest = temp, face = f;
+    return false;
+  });
+  return face >= 0 && Record(ray, t, FaceNormal(face), face, hit);
+}
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "graphics/bvh.h"
+#include "graphics/object.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace VCL {
+
+// A whole triangle mesh as a single Object. Vertices, indices and face
+// normals are kept as structure-of-arrays buffers and the triangles are
+// found through the mesh's own BVH, so there is no per-triangle allocation
+// or virtual call.
+class TriangleMesh final : public Object
+{
+protected:
+
+  std::vector<real> vx_, vy_, vz_; // vertex positions
+  std::vector<int> i0_, i1_, i2_;  // vertex indices, counter-clockwise seen from the front
+  std::vector<real> nx_, ny_, nz_; // unit face normals
+  BVH bvh_;
+
+public:
+
+  // Views of a mesh's buffers, for compiled scene files.
+  struct Arrays
+  {
+    const real *vx_, *vy_, *vz_;
+    int vertices_;
+    const int *i0_, *i1_, *i2_;
+    const real *nx_, *ny_, *nz_;
+    int triangles_;
+    const BVH::Node *nodes_;
+    int nodes_count_;
+    const int *indices_;
+  };
+
+  TriangleMesh(const Material *const mat, const std::vector<Vec3> &vertices, const std::vector<Vec3i> &triangles);
+
+  // Copies the buffers of another mesh's GetArrays(), without rebuilding
+  // the BVH.
+  TriangleMesh(const Material *const mat, const Arrays &arrays);
+
+  virtual ~TriangleMesh() = default;
+
+  // Wavefront OBJ, only v and f records are read, polygons are fanned.
+  // Returns nullptr if the file cannot be read.
+  static std::unique_ptr<TriangleMesh> LoadOBJ(const Material *const mat, const std::string &path,
+                                               const Mat4 &transform = Mat4::Identity());
+
+  int NumTriangles() const { return int(i0_.size()); }
+
+  Arrays GetArrays() const;
+
+  Vec3 Vertex(const int i) const { return Vec3(vx_[i], vy_[i], vz_[i]); }
+
+  Vec3 FaceNormal(const int f) const { return Vec3(nx_[f], ny_[f], nz_[f]); }
+
+  // face_ of the hit is the triangle
+  virtual bool Intersect(const Ray &ray, const real tmax, HitRecord &hit) const override;
+
+  virtual AABB Bounds() const override { return bvh_.Empty() ? AABB() : bvh_.nodes_[0].box_; }
+};
+
+}
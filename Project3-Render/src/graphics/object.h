@@ -1,11 +1,28 @@
 #pragma once
 
+#include "common/helperfunc.h"
 #include "graphics/material.h"
 
 #include <iostream>
 
 namespace VCL {
 
+class Object;
+
+// Closest intersection, filled once by the primitive that was hit.
+struct HitRecord
+{
+  real t_ = std::numeric_limits<real>::infinity();
+  Vec3 pos_;
+  // geometric normal
+  Vec3 n_;
+  const Object *obj_ = nullptr;
+  const Material *mat_ = nullptr;
+  // face of a polyhedron or triangle of a mesh, -1 if the object has one
+  // surface or the hit comes from the GBuffer
+  int face_ = -1;
+};
+
 class Object
 {
 public:
@@ -20,12 +37,36 @@ public:
 
   const Material *Mat() const { return mat_; }
 
-  virtual real Intersect(const Ray &ray) const = 0;
+  // Nearest intersection closer than tmax; fills all of hit only if there
+  // is one.
+  virtual bool Intersect(const Ray &ray, const real tmax, HitRecord &hit) const = 0;
+
+  virtual AABB Bounds() const = 0;
+
+  // Next-event estimation: picks a point pos on the surface as seen from p
+  // and returns the solid angle density of the direction towards it, or 0
+  // if the object cannot be sampled from p.
+  virtual real SampleSurface(const Vec3 & /*p*/, const Vec2 & /*u*/, Vec3 & /*pos*/) const { return 0; }
+
+  // Density with which SampleSurface(p, ...) picks the direction to the
+  // point hit on this object.
+  virtual real SurfacePdf(const Vec3 & /*p*/, const HitRecord & /*hit*/) const { return 0; }
 
-  virtual Vec3 ClosestNormal(const Vec3 &pos) const = 0;
+protected:
+
+  bool Record(const Ray &ray, const real t, const Vec3 &n, const int face, HitRecord &hit) const
+  {
+    hit.t_ = t;
+    hit.pos_ = ray.ori_ + ray.dir_ * t;
+    hit.n_ = n;
+    hit.obj_ = this;
+    hit.mat_ = mat_;
+    hit.face_ = face;
+    return true;
+  }
 };
 
-class Plane : public Object
+class Plane final : public Object
 {
 protected:
 
@@ -42,18 +83,32 @@ public:
 
   virtual ~Plane() = default;
 
-  virtual real Intersect(const Ray &ray) const override
+  const Vec3 &Point() const { return pos_; }
+
+  const Vec3 &Normal() const { return n_; }
+
+  virtual bool Intersect(const Ray &ray, const real tmax, HitRecord &hit) const override
   {
     real num = (pos_ - ray.ori_).dot(n_);
     real den = ray.dir_.dot(n_);
-    if (den > -EPS_) return std::numeric_limits<real>::infinity();
-    return (num / den);
+    if (den > -EPS_) return false;
+    const real t = num / den;
+    return t < tmax && Record(ray, t, n_, -1, hit);
   }
 
-  virtual Vec3 ClosestNormal(const Vec3 &position) const { return n_; }
+  // planes are unbounded, only the part inside the room can be hit
+  virtual AABB Bounds() const override
+  {
+    AABB box(POSMIN_, POSMAX_);
+    for (int i = 0; i < 3; ++i)
+    {
+      if (std::abs(std::abs(n_[i]) - 1) < EPS_) box.min_[i] = box.max_[i] = pos_[i];
+    }
+    return box;
+  }
 };
 
-class Sphere : public Object
+class Sphere final : public Object
 {
 protected:
 
@@ -70,22 +125,54 @@ public:
 
   virtual ~Sphere() = default;
 
-  virtual real Intersect(const Ray &ray) const override
+  const Vec3 &Center() const { return cen_; }
+
+  real Radius() const { return rad_; }
+
+  virtual bool Intersect(const Ray &ray, const real tmax, HitRecord &hit) const override
   {
     real b = ray.dir_.dot(ray.ori_ - cen_);
     real c = (ray.ori_ - cen_).dot(ray.ori_ - cen_) - rad_ * rad_;
     real delta = b * b - c;
-    if (delta < 0) return std::numeric_limits<real>::infinity();
+    if (delta < 0) return false;
     real t1 = -b - std::sqrt(delta), t2 = -b + std::sqrt(delta);
-    if (t2 < 0) return std::numeric_limits<real>::infinity();
-    else if (t1 < 0) return t2;
-    return t1;
+    if (t2 < 0) return false;
+    const real t = t1 < 0 ? t2 : t1;
+    if (!(t < tmax)) return false;
+    Record(ray, t, Vec3::Zero(), -1, hit);
+    hit.n_ = (hit.pos_ - cen_) / rad_;
+    return true;
   }
 
-  virtual Vec3 ClosestNormal(const Vec3 &pos) const { return (pos - cen_).normalized(); }
+  virtual AABB Bounds() const override { return AABB(cen_ - Vec3::Constant(rad_), cen_ + Vec3::Constant(rad_)); }
+
+  // uniform in the cone of directions the sphere covers
+  virtual real SampleSurface(const Vec3 &p, const Vec2 &u, Vec3 &pos) const override
+  {
+    const Vec3 dc = cen_ - p;
+    const real d2 = dc.squaredNorm();
+    if (d2 <= rad_ * rad_) return 0;
+    const real sin2_max = rad_ * rad_ / d2;
+    const real one_minus_cos = sin2_max / (1 + std::sqrt(1 - sin2_max)); // 1 - cos_max, without cancellation
+    const real h = u[0] * one_minus_cos;
+    const real sin_theta = std::sqrt(std::max(real(0), h * (2 - h)));
+    const Vec3 dir = SphericalDirection(dc / std::sqrt(d2), 1 - h, sin_theta, 2 * PI_ * u[1]);
+    // nearest intersection, or the closest point of a grazing ray
+    const real b = dir.dot(dc);
+    pos = p + dir * (b - std::sqrt(std::max(real(0), b * b - d2 + rad_ * rad_)));
+    return 1 / (2 * PI_ * one_minus_cos);
+  }
+
+  virtual real SurfacePdf(const Vec3 &p, const HitRecord & /*hit*/) const override
+  {
+    const real d2 = (cen_ - p).squaredNorm();
+    if (d2 <= rad_ * rad_) return 0;
+    const real sin2_max = rad_ * rad_ / d2;
+    return (1 + std::sqrt(1 - sin2_max)) / (2 * PI_ * sin2_max);
+  }
 };
 
-class Tetrahedron : public Object
+class Tetrahedron final : public Object
 {
 protected:
 
@@ -111,9 +198,10 @@ public:
 
   virtual ~Tetrahedron() = default;
 
-  virtual real Intersect(const Ray &ray) const override
+  virtual bool Intersect(const Ray &ray, const real tmax, HitRecord &hit) const override
   {
-    real t = std::numeric_limits<real>::infinity();
+    real t = tmax;
+    int face = -1;
     for (int i = 0; i < 4; ++i)
     {
       real num = (p_[i] - ray.ori_).dot(n_[i]);
@@ -131,29 +219,21 @@ public:
         real z1 = PA.cross(PB).z();
         real z2 = PB.cross(PC).z();
         real z3 = PC.cross(PA).z();
-        if ((z1 * z2 > 0) && (z2 * z3 > 0)) t = tmp;
+        if ((z1 * z2 > 0) && (z2 * z3 > 0)) t = tmp, face = i;
       }
     }
-    return t;
+    return face >= 0 && Record(ray, t, n_[face], face, hit);
   }
 
-  virtual Vec3 ClosestNormal(const Vec3 &pos) const 
-  { 
-    for (int i = 0; i < 4; ++i)
-    {
-      Vec3 PA = p_[idx_[i][0]] - pos;
-      Vec3 PB = p_[idx_[i][1]] - pos;
-      Vec3 PC = p_[idx_[i][2]] - pos;
-
-      real z1 = PA.cross(PB).z();
-      real z2 = PB.cross(PC).z();
-      real z3 = PC.cross(PA).z();
-      if ((z1 * z2 > 0) && (z2 * z3 > 0)) return n_[i];
-    }
+  virtual AABB Bounds() const override
+  {
+    AABB box;
+    for (int i = 0; i < 4; ++i) box.Extend(p_[i]);
+    return box;
   }
 };
 
-class Cuboid : public Object
+class Cuboid final : public Object
 {
 protected:
 
@@ -162,7 +242,6 @@ protected:
   const real h_;
   const real w_;
 
-  Vec3 pos_[6];
   Vec3 n_[6] = {Vec3(1, 0, 0), Vec3(-1, 0, 0), Vec3(0, 1, 0), Vec3(0, -1, 0), Vec3(0, 0, 1), Vec3(0, 0, -1)};
 
 public:
@@ -173,48 +252,91 @@ public:
     l_(l),
     h_(h),
     w_(w)
+  { }
+
+  virtual ~Cuboid() = default;
+
+  // slab test, the entry point from outside; the face is the one of the
+  // slab entered last
+  virtual bool Intersect(const Ray &ray, const real tmax, HitRecord &hit) const override
   {
-    pos_[0] = cen_ + Vec3(real(l_)/2, 0, 0);
-    pos_[1] = cen_ - Vec3(real(l_)/2, 0, 0);
-    pos_[2] = cen_ + Vec3(0, real(h_)/2, 0);
-    pos_[3] = cen_ - Vec3(0, real(h_)/2, 0);
-    pos_[4] = cen_ + Vec3(0, 0, real(w_)/2);
-    pos_[5] = cen_ - Vec3(0, 0, real(w_)/2);
+    const Vec3 half = Vec3(l_, h_, w_) / 2;
+    const Vec3 t0 = (cen_ - half - ray.ori_).cwiseQuotient(ray.dir_);
+    const Vec3 t1 = (cen_ + half - ray.ori_).cwiseQuotient(ray.dir_);
+    int axis;
+    const real tnear = t0.cwiseMin(t1).maxCoeff(&axis);
+    const real tfar = t0.cwiseMax(t1).minCoeff();
+    if (!(tnear > 0 && tnear <= tfar && tnear < tmax)) return false;
+    const int face = 2 * axis + (ray.dir_[axis] > 0);
+    return Record(ray, tnear, n_[face], face, hit);
   }
 
-  virtual ~Cuboid() = default;
+  virtual AABB Bounds() const override
+  {
+    const Vec3 half = Vec3(l_, h_, w_) / 2;
+    return AABB(cen_ - half, cen_ + half);
+  }
 
-  virtual real Intersect(const Ray &ray) const override
+  // uniform by area over the faces turned towards p, which do not overlap
+  // as seen from p
+  virtual real SampleSurface(const Vec3 &p, const Vec2 &u, Vec3 &pos) const override
   {
-    real t = std::numeric_limits<real>::infinity();
-    // std::cout<<"ori:("<<ray.ori_[0]<<","<<ray.ori_[1]<<","<<ray.ori_[2]<<")"<<std::endl;
-    // std::cout<<"dir:("<<ray.dir_[0]<<","<<ray.dir_[1]<<","<<ray.dir_[2]<<")"<<std::endl;
-    for (int i = 0; i < 6; ++i)
+    int side[3];
+    real area[3];
+    const real total = FacingArea(p, side, area);
+    if (total <= 0) return 0;
+
+    real s = u[0] * total;
+    int axis = 0;
+    while (axis < 2 && (s >= area[axis] || area[axis] <= 0))
     {
-      real num = (pos_[i] - ray.ori_).dot(n_[i]);
-      real den = ray.dir_.dot(n_[i]);
-      real tmp = num / den;
-      if (den < EPS_ && tmp > 0)
-      {
-        if (!(tmp < t)) continue;
-        Vec3 pos = ray.ori_ + ray.dir_ * tmp;
-        Vec3 dis = pos - cen_;
-        if ((std::abs(dis[0]) < real(l_)/2+EPS_) && (std::abs(dis[1]) < real(h_)/2+EPS_) &&
-          (std::abs(dis[2]) < real(w_)/2+EPS_)) t = tmp;
-      }
+      s -= area[axis];
+      ++axis;
     }
-    return t;
+    while (area[axis] <= 0) --axis;
+    const int a1 = (axis + 1) % 3, a2 = (axis + 2) % 3;
+    const Vec3 half = Vec3(l_, h_, w_) / 2;
+    pos = cen_;
+    pos[axis] += side[axis] * half[axis];
+    pos[a1] += (2 * std::min(s / area[axis], real(1)) - 1) * half[a1];
+    pos[a2] += (2 * u[1] - 1) * half[a2];
+
+    const Vec3 dir = pos - p;
+    const real d2 = dir.squaredNorm();
+    return d2 * std::sqrt(d2) / (std::abs(dir[axis]) * total);
+  }
+
+  virtual real SurfacePdf(const Vec3 &p, const HitRecord &hit) const override
+  {
+    int side[3];
+    real area[3];
+    const real total = FacingArea(p, side, area);
+    if (total <= 0) return 0;
+    const Vec3 &n = hit.n_;
+    int axis = 0;
+    for (int i = 1; i < 3; ++i) if (std::abs(n[i]) > std::abs(n[axis])) axis = i;
+    if (side[axis] == 0 || side[axis] * n[axis] < 0) return 0;
+    const Vec3 dir = hit.pos_ - p;
+    const real d2 = dir.squaredNorm();
+    return d2 * std::sqrt(d2) / (std::abs(dir[axis]) * total);
   }
 
-  virtual Vec3 ClosestNormal(const Vec3 &pos) const 
-  { 
-    Vec3 dis = pos - cen_;
-    if (std::abs(dis[0] - real(l_)/2) < EPS_) return (n_[0]).normalized();
-    else if (std::abs(dis[0] + real(l_)/2) < EPS_) return (n_[1]).normalized();
-    else if (std::abs(dis[1] - real(h_)/2) < EPS_) return (n_[2]).normalized();
-    else if (std::abs(dis[1] + real(h_)/2) < EPS_) return (n_[3]).normalized();
-    else if (std::abs(dis[2] - real(w_)/2) < EPS_) return (n_[4]).normalized();
-    else if (std::abs(dis[2] + real(w_)/2) < EPS_) return (n_[5]).normalized();
+private:
+
+  // side[i] is +1 / -1 if the face on that side of axis i faces p, else 0
+  real FacingArea(const Vec3 &p, int side[3], real area[3]) const
+  {
+    const Vec3 half = Vec3(l_, h_, w_) / 2;
+    const Vec3 face(h_ * w_, l_ * w_, l_ * h_);
+    real total = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+      const real d = p[i] - cen_[i];
+      side[i] = d > half[i] ? 1 : d < -half[i] ? -1 : 0;
+      area[i] = side[i] ? face[i] : 0;
+      total += area[i];
+    }
+    return total;
   }
 };
 
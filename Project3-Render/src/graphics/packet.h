@@ -0,0 +1,94 @@
+#pragma once
+
+#include "common/simd.h"
+#include "graphics/object.h"
+
+namespace VCL {
+
+// SIMD_WIDTH_ rays in structure-of-arrays layout. Lanes whose bit is not
+// set in active_ are ignored.
+struct RayPacket
+{
+  alignas(32) float ox_[SIMD_WIDTH_];
+  alignas(32) float oy_[SIMD_WIDTH_];
+  alignas(32) float oz_[SIMD_WIDTH_];
+  alignas(32) float dx_[SIMD_WIDTH_];
+  alignas(32) float dy_[SIMD_WIDTH_];
+  alignas(32) float dz_[SIMD_WIDTH_];
+  int active_ = 0;
+
+  Ray Lane(const int i) const { return Ray(Vec3(ox_[i], oy_[i], oz_[i]), Vec3(dx_[i], dy_[i], dz_[i])); }
+};
+
+// A packet loaded into registers, with the reciprocal directions for slab tests.
+struct PacketRays
+{
+  vfloat ox_, oy_, oz_;
+  vfloat dx_, dy_, dz_;
+  vfloat ix_, iy_, iz_;
+
+  explicit PacketRays(const RayPacket &p) :
+    ox_(vfloat::Load(p.ox_)), oy_(vfloat::Load(p.oy_)), oz_(vfloat::Load(p.oz_)),
+    dx_(vfloat::Load(p.dx_)), dy_(vfloat::Load(p.dy_)), dz_(vfloat::Load(p.dz_)),
+    ix_(vfloat(1) / dx_), iy_(vfloat(1) / dy_), iz_(vfloat(1) / dz_)
+  { }
+};
+
+// Per-lane distances to the box over [0, tmax]; lanes that miss are cleared
+// in the returned mask.
+inline vmask IntersectBoxPacket(const AABB &box, const PacketRays &r, const vfloat &tmax, vfloat &tnear)
+{
+  const vfloat x0 = (vfloat(box.min_[0]) - r.ox_) * r.ix_, x1 = (vfloat(box.max_[0]) - r.ox_) * r.ix_;
+  const vfloat y0 = (vfloat(box.min_[1]) - r.oy_) * r.iy_, y1 = (vfloat(box.max_[1]) - r.oy_) * r.iy_;
+  const vfloat z0 = (vfloat(box.min_[2]) - r.oz_) * r.iz_, z1 = (vfloat(box.max_[2]) - r.oz_) * r.iz_;
+  tnear = Max(Max(Max(vfloat(0), Min(x0, x1)), Min(y0, y1)), Min(z0, z1));
+  const vfloat tfar = Min(Min(Min(tmax, Max(x0, x1)), Max(y0, y1)), Max(z0, z1));
+  return tnear <= tfar;
+}
+
+// Packet versions of Object::Intersect, infinity where a lane misses.
+
+inline vfloat IntersectPacket(const Plane &plane, const PacketRays &r, const RayPacket &)
+{
+  const Vec3 &p = plane.Point(), &n = plane.Normal();
+  const vfloat num = (vfloat(p[0]) - r.ox_) * n[0] + (vfloat(p[1]) - r.oy_) * n[1] + (vfloat(p[2]) - r.oz_) * n[2];
+  const vfloat den = r.dx_ * n[0] + r.dy_ * n[1] + r.dz_ * n[2];
+  return Select(den > vfloat(-EPS_), vfloat(std::numeric_limits<float>::infinity()), num / den);
+}
+
+inline vfloat IntersectPacket(const Sphere &sphere, const PacketRays &r, const RayPacket &)
+{
+  const Vec3 &c = sphere.Center();
+  const vfloat ocx = r.ox_ - c[0], ocy = r.oy_ - c[1], ocz = r.oz_ - c[2];
+  const vfloat b = r.dx_ * ocx + r.dy_ * ocy + r.dz_ * ocz;
+  const vfloat cc = ocx * ocx + ocy * ocy + ocz * ocz - sphere.Radius() * sphere.Radius();
+  const vfloat delta = b * b - cc;
+  const vfloat sq = Sqrt(Max(delta, vfloat(0)));
+  const vfloat t1 = -b - sq, t2 = -b + sq;
+  const vfloat t = Select(t1 < vfloat(0), t2, t1);
+  return Select((delta < vfloat(0)) | (t2 < vfloat(0)), vfloat(std::numeric_limits<float>::infinity()), t);
+}
+
+inline vfloat IntersectPacket(const Cuboid &cuboid, const PacketRays &r, const RayPacket &)
+{
+  // slab test; the entry point is the nearest front face
+  const AABB box = cuboid.Bounds();
+  vfloat tnear;
+  const vmask hit = IntersectBoxPacket(box, r, vfloat(std::numeric_limits<float>::infinity()), tnear);
+  return Select(hit & (tnear > vfloat(0)), tnear, vfloat(std::numeric_limits<float>::infinity()));
+}
+
+// any other primitive, one lane at a time
+template <typename T>
+vfloat IntersectPacket(const T &prim, const PacketRays &, const RayPacket &packet)
+{
+  alignas(32) float t[SIMD_WIDTH_];
+  for (int i = 0; i < SIMD_WIDTH_; ++i) {
+    HitRecord hit;
+    t[i] = (packet.active_ >> i & 1) && prim.Intersect(packet.Lane(i), std::numeric_limits<float>::infinity(), hit)
+             ? hit.t_ : std::numeric_limits<float>::infinity();
+  }
+  return vfloat::Load(t);
+}
+
+}
@@ -12,6 +12,7 @@ class VWindow {
   // keys
   // buttoms
   // callbacks
+  virtual ~VWindow() = default;
   virtual void Init(const std::string& title, int& width, int& height, void* renderer) = 0;
   virtual void Destroy() = 0;
   virtual void DrawBuffer(Framebuffer* buffer) = 0;
@@ -19,6 +20,7 @@ class VWindow {
 
 void InitPlatform();
 void DestroyPlatform();
+bool HasDisplay();
 VWindow* CreateVWindow(const std::string& title, int& width, int& height, void* renderer);
 
 void PollInputEvents();
@@ -1,24 +1,170 @@
 #include "scene.h"
 
+#include <algorithm>
+
+#include "common/stats.h"
+
 namespace VCL {
 
-Object *Scene::Intersect(const Ray &ray, Vec3 &pos) const
+void Scene::Build()
+{
+  // nothing outside the room can be hit, so clip the boxes to it
+  const real pad = real(1e-3);
+  compiled_.Build(objs_, AABB(POSMIN_, POSMAX_), pad);
+
+  // power ~ emission times the area of the bounds inside the room
+  emitters_.clear();
+  emitter_cdf_.clear();
+  real total = 0;
+  for (const PrimRef entry : compiled_.refs_) {
+    compiled_.ForEach(entry, [&](const PrimRef ref) {
+      compiled_.Visit(ref, [&](const auto &prim) {
+        if (!prim.Mat()->emissive_) return;
+        total += prim.Mat()->k_d_.mean() * prim.Bounds().Clip(AABB(POSMIN_, POSMAX_)).SurfaceArea();
+        emitters_.push_back(&prim);
+        emitter_cdf_.push_back(total);
+      });
+    });
+  }
+  if (total <= 0) {
+    emitters_.clear();
+    emitter_cdf_.clear();
+  }
+  for (real &c : emitter_cdf_) c /= total;
+}
+
+BatchRay Scene::MakeBatchRay(const Ray &ray)
 {
-  Object *collider = nullptr;
-  real dist = std::numeric_limits<real>::infinity();
-  for (const auto &object : objs_) {
-    const real temp = object->Intersect(ray);
-    if (temp < dist) {
-      const Vec3 pos_t = ray.ori_ + ray.dir_ * temp;
-      if (((POSMIN_ - pos_t).array() <= EPS_).all() && ((pos_t - POSMAX_).array() <= EPS_).all()) {
-        dist = temp;
-        pos = pos_t;
-        collider = object.get();
+  BatchRay r;
+  for (int i = 0; i < 3; ++i) {
+    r.ori_[i] = ray.ori_[i];
+    r.dir_[i] = ray.dir_[i];
+    r.inv_[i] = 1 / ray.dir_[i];
+    r.lo_[i] = POSMIN_[i] - EPS_;
+    r.hi_[i] = POSMAX_[i] + EPS_;
+  }
+  r.eps_ = EPS_;
+  return r;
+}
+
+bool Scene::Intersect(const Ray &ray, HitRecord &hit) const
+{
+  const BatchRay batch_ray = MakeBatchRay(ray);
+  hit.obj_ = nullptr;
+  hit.t_ = std::numeric_limits<real>::infinity();
+  real t = hit.t_;
+  compiled_.Traverse(ray, t, [&](const PrimRef ref, real &tmax) {
+    if (ref.type_ == compiled_.BATCH_) {
+      const PrimBatch &batch = compiled_.batches_[ref.index_];
+      VCL_STAT_AT(PlaneTests, batch.type_, batch.count_);
+      int lane;
+      const real temp = IntersectBatch(batch, batch_ray, tmax, false, lane);
+      if (temp < tmax) {
+        tmax = temp;
+        float n[3];
+        BatchNormal(batch, batch_ray, lane, temp, n, hit.face_);
+        hit.t_ = temp;
+        hit.pos_ = ray.ori_ + ray.dir_ * temp;
+        hit.n_ = Vec3(n[0], n[1], n[2]);
+        compiled_.Visit(PrimRef{batch.type_, batch.first_ + lane}, [&](const auto &prim) {
+          hit.obj_ = &prim;
+          hit.mat_ = prim.Mat();
+        });
       }
+      return false;
     }
+    // Stat's test counters follow the order of compiled_'s types
+    VCL_STAT_AT(PlaneTests, ref.type_, 1);
+    HitRecord temp;
+    if (compiled_.Visit(ref, [&](const auto &prim) { return prim.Intersect(ray, tmax, temp); }) && InRoom(temp.pos_)) {
+      tmax = temp.t_;
+      hit = temp;
+    }
+    return false;
+  });
+  return hit.obj_ != nullptr;
+}
+
+bool Scene::Occluded(const Ray &ray, const real tmax) const
+{
+  VCL_STAT(ShadowRays, 1);
+  const BatchRay batch_ray = MakeBatchRay(ray);
+  real t = tmax;
+  return compiled_.Traverse(ray, t, [&](const PrimRef ref, real &tmax) {
+    if (ref.type_ == compiled_.BATCH_) {
+      const PrimBatch &batch = compiled_.batches_[ref.index_];
+      VCL_STAT_AT(PlaneTests, batch.type_, batch.count_);
+      int lane;
+      return IntersectBatch(batch, batch_ray, tmax, true, lane) < tmax;
+    }
+    VCL_STAT_AT(PlaneTests, ref.type_, 1);
+    return compiled_.Visit(ref, [&](const auto &prim) {
+      if (prim.Mat()->emissive_) return false;
+      HitRecord temp;
+      return prim.Intersect(ray, tmax, temp) && InRoom(temp.pos_);
+    });
+  });
+}
+
+const Object *Scene::SampleEmitter(const real u, real &pdf) const
+{
+  if (emitters_.empty()) return nullptr;
+  const size_t i = std::min(size_t(std::upper_bound(emitter_cdf_.begin(), emitter_cdf_.end(), u) - emitter_cdf_.begin()),
+                            emitters_.size() - 1);
+  pdf = emitter_cdf_[i] - (i > 0 ? emitter_cdf_[i - 1] : 0);
+  return emitters_[i];
+}
+
+real Scene::EmitterPdf(const Object *obj) const
+{
+  const size_t i = std::find(emitters_.begin(), emitters_.end(), obj) - emitters_.begin();
+  if (i == emitters_.size()) return 0;
+  return emitter_cdf_[i] - (i > 0 ? emitter_cdf_[i - 1] : 0);
+}
+
+int Scene::IntersectPacket(const RayPacket &packet, HitRecord *hits) const
+{
+  const PacketRays rays(packet);
+  vfloat tmax(std::numeric_limits<float>::infinity());
+  PrimRef collider[SIMD_WIDTH_] = {};
+  int found = 0;
+  // batches are split up, the lanes of a packet hold rays instead
+  compiled_.TraversePacket(rays, packet, tmax, packet.active_, [&](const PrimRef entry, vfloat &tmax, const int active) {
+    compiled_.ForEach(entry, [&](const PrimRef ref) {
+      VCL_STAT_AT(PlaneTests, ref.type_, Stats::Lanes(active));
+      const vfloat t = compiled_.Visit(ref, [&](const auto &prim) { return VCL::IntersectPacket(prim, rays, packet); });
+      const vfloat px = rays.ox_ + rays.dx_ * t;
+      const vfloat py = rays.oy_ + rays.dy_ * t;
+      const vfloat pz = rays.oz_ + rays.dz_ * t;
+      const vmask in_room = (px >= vfloat(POSMIN_[0] - EPS_)) & (px <= vfloat(POSMAX_[0] + EPS_)) &
+                            (py >= vfloat(POSMIN_[1] - EPS_)) & (py <= vfloat(POSMAX_[1] + EPS_)) &
+                            (pz >= vfloat(POSMIN_[2] - EPS_)) & (pz <= vfloat(POSMAX_[2] + EPS_));
+      const vmask closer = (t < tmax) & in_room;
+      const int mask = closer.Bits() & active;
+      if (!mask) return;
+      tmax = Select(closer, t, tmax);
+      for (int i = 0; i < SIMD_WIDTH_; ++i) {
+        if (mask >> i & 1) collider[i] = ref;
+      }
+      found |= mask;
+    });
+  });
+
+  // the winners fill their records with the scalar test; on the rare
+  // grazing ray where it disagrees with the packet test the lane is traced
+  // again on its own
+  for (int i = 0; i < SIMD_WIDTH_; ++i) {
+    HitRecord &hit = hits[i];
+    hit.obj_ = nullptr;
+    hit.t_ = std::numeric_limits<real>::infinity();
+    if (!(found >> i & 1)) continue;
+    const Ray ray = packet.Lane(i);
+    const bool ok = compiled_.Visit(collider[i], [&](const auto &prim) {
+      return prim.Intersect(ray, std::numeric_limits<real>::infinity(), hit);
+    });
+    if ((!ok || !InRoom(hit.pos_)) && !Intersect(ray, hit)) found &= ~(1 << i);
   }
-  pos = pos.cwiseMax(POSMIN_).cwiseMin(POSMAX_);
-  return collider;
+  return found;
 }
 
-}
\ No newline at end of file
+}
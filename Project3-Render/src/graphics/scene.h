@@ -1,5 +1,6 @@
 #pragma once
 
+#include "graphics/compiledscene.h"
 #include "graphics/object.h"
 #include "graphics/light.h"
 
@@ -18,12 +19,46 @@ public:
   std::map<std::string, std::unique_ptr<Material>> mats_;
   std::vector<std::unique_ptr<Light>> lights_;
 
+  // meshes and other large objects are referenced from objs_
+  CompiledScene<Plane, Sphere, Tetrahedron, Cuboid> compiled_;
+
+  // emissive primitives of compiled_ and the CDF of their rough power
+  std::vector<const Object *> emitters_;
+  std::vector<real> emitter_cdf_;
+
 public:
 
   Scene() = default;
   virtual ~Scene() = default;
 
-  Object *Intersect(const Ray &ray, Vec3 &pos) const;
+  // Flattens objs_ into compiled_ and builds its acceleration structure,
+  // call once objs_ is complete.
+  void Build();
+
+  // Hits outside the room box are ignored by all queries.
+  static bool InRoom(const Vec3 &p)
+  {
+    return ((POSMIN_ - p).array() <= EPS_).all() && ((p - POSMAX_).array() <= EPS_).all();
+  }
+
+  bool Intersect(const Ray &ray, HitRecord &hit) const;
+
+  // ray for the batch kernels, its hits clipped to the room like InRoom()
+  static BatchRay MakeBatchRay(const Ray &ray);
+
+  // Any-hit query: true if something is hit before tmax. Emissive surfaces
+  // do not block, so a light is not shadowed by its own emitter.
+  bool Occluded(const Ray &ray, const real tmax) const;
+
+  // Closest hits of the active lanes of a packet, returns the mask of lanes
+  // that hit something. hits has SIMD_WIDTH_ entries.
+  int IntersectPacket(const RayPacket &packet, HitRecord *hits) const;
+
+  // Picks an emitter for next-event estimation, nullptr if there is none.
+  const Object *SampleEmitter(const real u, real &pdf) const;
+
+  // Probability of SampleEmitter picking obj.
+  real EmitterPdf(const Object *obj) const;
 };
 
 }
@@ -0,0 +1,513 @@
+#include "scenefile.h"
+
+#include "common/helperfunc.h"
+#include "common/mappedfile.h"
+#include "graphics/instance.h"
+#include "graphics/light.h"
+#include "graphics/mesh.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+
+// Scene files have one statement per line, # starts a comment. Colors are
+// linear in [0, 1], angles in degrees, materials are referred to by name
+// and must be defined first.
+//
+//   ambient <r g b>
+//   camera <fovy> <radius> <phi> <theta> <target x y z>
+//   material <name> <diffuse r g b> [<specular r g b> <shininess, -1 = mirror>]
+//   emitter <name> <r g b>
+//   plane <material> <point x y z> <normal x y z>
+//   sphere <material> <center x y z> <radius>
+//   cuboid <material> <center x y z> <size x y z>
+//   tetrahedron <material> <x y z> <x y z> <x y z> <x y z>
+//   mesh <material> <file.obj, relative to the scene file> [<scale> [<offset x y z>]]
+//   light <position x y z> <intensity r g b>
+//   prototype <name>
+//     <cuboid, sphere, tetrahedron and mesh statements, in object space>
+//   end
+//   instance <prototype> <offset x y z> [<rotation about y> [<scale>]]
+//
+// Instances share their prototype's objects and its BVH. Prototypes hold
+// no planes or emitters.
+//
+// The compiled form is a header, the files it was made from, then raw
+// arrays of the records below, each 8 byte aligned so that they can be read
+// in place from the mapping.
+
+namespace VCL {
+
+namespace {
+
+constexpr char MAGIC_[8] = {'V', 'C', 'L', 'S', 'C', 'E', 'N', 'E'};
+constexpr uint32_t VERSION_ = 2;
+
+enum class Shape : uint32_t { Plane = 0, Sphere, Cuboid, Tetrahedron };
+
+struct Header
+{
+  char magic_[8];
+  uint32_t version_;
+  uint32_t real_size_;
+  uint64_t stamp_; // Stamp() of the files
+  uint32_t files_;
+  uint32_t materials_;
+  uint32_t objects_;
+  uint32_t lights_;
+  uint32_t meshes_;
+  uint32_t prototypes_;
+  uint32_t instances_;
+  uint32_t reserved_;
+  float ambient_[3];
+  CameraSetup camera_;
+};
+
+struct MaterialRecord
+{
+  float k_d_[3];
+  float k_s_[3];
+  float alpha_;
+  uint32_t emissive_;
+};
+
+// prototype_ is 0 for objects of the scene, k + 1 for those of prototype k
+struct ObjectRecord
+{
+  Shape shape_;
+  uint32_t material_;
+  uint32_t prototype_;
+  real params_[12];
+};
+
+struct LightRecord
+{
+  real position_[3];
+  real intensity_[3];
+};
+
+struct MeshRecord
+{
+  uint32_t material_;
+  uint32_t prototype_;
+  int32_t vertices_;
+  int32_t triangles_;
+  int32_t nodes_;
+};
+
+struct InstanceRecord
+{
+  uint32_t prototype_;
+  real transform_[12]; // rows of the affine part, object space to the scene
+};
+
+// A scene between parsing and Scene, with what the compiled form needs.
+struct SceneDesc
+{
+  Color ambient_ = Color::Zero();
+  CameraSetup camera_;
+  std::vector<std::string> files_;
+  std::vector<std::string> material_names_;
+  std::vector<std::unique_ptr<Material>> materials_;
+  std::vector<ObjectRecord> objects_;
+  std::vector<LightRecord> lights_;
+  std::vector<uint32_t> mesh_materials_;
+  std::vector<uint32_t> mesh_prototypes_;
+  std::vector<std::unique_ptr<TriangleMesh>> meshes_;
+  std::vector<std::string> prototype_names_; // only while parsing
+  uint32_t prototypes_ = 0;
+  std::vector<InstanceRecord> instances_;
+};
+
+// Paths, sizes and modification times of the files, 0 if one is missing.
+uint64_t Stamp(const std::vector<std::string> &files)
+{
+  uint64_t hash = HashBytes(nullptr, 0);
+  for (const std::string &file : files) {
+    std::error_code ec;
+    const uint64_t size = std::filesystem::file_size(file, ec);
+    if (ec) return 0;
+    const int64_t time = std::filesystem::last_write_time(file, ec).time_since_epoch().count();
+    if (ec) return 0;
+    hash = HashBytes(file.data(), file.size(), hash);
+    hash = HashBytes(&size, sizeof(size), hash);
+    hash = HashBytes(&time, sizeof(time), hash);
+  }
+  return hash;
+}
+
+bool ParseText(const std::string &path, SceneDesc &desc)
+{
+  std::ifstream file(path);
+  if (!file) {
+    spdlog::error("cannot open scene {}", path);
+    return false;
+  }
+  desc.files_.push_back(path);
+
+  std::string line, tag;
+  int line_no = 0;
+  // 0 outside of prototypes, as ObjectRecord::prototype_
+  uint32_t prototype = 0;
+  size_t prototype_first = 0;
+  const auto fail = [&](const std::string &what) {
+    spdlog::error("{}:{}: {}: {}", path, line_no, what, line);
+    return false;
+  };
+  const auto read = [](std::istream &in, real *values, int n) {
+    for (int i = 0; i < n; ++i)
+      if (!(in >> values[i])) return false;
+    return true;
+  };
+  while (std::getline(file, line)) {
+    ++line_no;
+    std::istringstream in(line.substr(0, line.find('#')));
+    if (!(in >> tag)) continue;
+
+    real v[12];
+    std::string name;
+    if (prototype && (tag == "plane" || tag == "light" || tag == "prototype" || tag == "instance"))
+      return fail("no " + tag + " statements in a prototype");
+    if (tag == "prototype") {
+      if (!(in >> name)) return fail("expected a name");
+      if (std::find(desc.prototype_names_.begin(), desc.prototype_names_.end(), name) != desc.prototype_names_.end())
+        return fail("prototype defined twice");
+      desc.prototype_names_.push_back(name);
+      prototype = ++desc.prototypes_;
+      prototype_first = desc.objects_.size() + desc.meshes_.size();
+    }
+    else if (tag == "end") {
+      if (!prototype) return fail("end outside of a prototype");
+      if (desc.objects_.size() + desc.meshes_.size() == prototype_first) return fail("empty prototype");
+      prototype = 0;
+    }
+    else if (tag == "instance") {
+      if (!(in >> name)) return fail("expected a prototype");
+      const auto proto = std::find(desc.prototype_names_.begin(), desc.prototype_names_.end(), name);
+      if (proto == desc.prototype_names_.end()) return fail("unknown prototype " + name);
+      if (!read(in, v, 3)) return fail("expected an offset");
+      real angle = 0, scale = 1;
+      if (in >> angle) in >> scale;
+      if (!(scale > 0)) return fail("scale should be positive");
+      Mat4 transform = Mat4::Identity();
+      transform.topLeftCorner<3, 3>() = Eigen::AngleAxis<real>(angle * PI_ / 180, Vec3::UnitY()).toRotationMatrix() * scale;
+      transform.topRightCorner<3, 1>() = Vec3(v[0], v[1], v[2]);
+      InstanceRecord instance{uint32_t(proto - desc.prototype_names_.begin()), {}};
+      for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 4; ++c) instance.transform_[4 * r + c] = transform(r, c);
+      desc.instances_.push_back(instance);
+    }
+    else if (tag == "ambient") {
+      if (!read(in, v, 3)) return fail("expected a color");
+      desc.ambient_ = Color(v[0], v[1], v[2]);
+    }
+    else if (tag == "camera") {
+      if (!read(in, v, 7)) return fail("expected fovy, radius, phi, theta and a target");
+      const float to_rad = float(PI_) / 180;
+      desc.camera_ = CameraSetup{float(v[0]) * to_rad, float(v[1]), float(v[2]) * to_rad,
+                                 float(v[3]) * to_rad, Vec3f(float(v[4]), float(v[5]), float(v[6]))};
+    }
+    else if (tag == "material" || tag == "emitter") {
+      if (!(in >> name) || !read(in, v, 3)) return fail("expected a name and a color");
+      if (std::find(desc.material_names_.begin(), desc.material_names_.end(), name) != desc.material_names_.end())
+        return fail("material defined twice");
+      const Color k_d(v[0], v[1], v[2]);
+      if (tag == "emitter") desc.materials_.push_back(std::make_unique<Material>(k_d, true));
+      else if (read(in, v, 4)) desc.materials_.push_back(std::make_unique<Material>(k_d, Color(v[0], v[1], v[2]), v[3]));
+      else desc.materials_.push_back(std::make_unique<Material>(k_d));
+      desc.material_names_.push_back(name);
+    }
+    else if (tag == "light") {
+      if (!read(in, v, 6)) return fail("expected a position and an intensity");
+      LightRecord light;
+      std::copy(v, v + 3, light.position_);
+      std::copy(v + 3, v + 6, light.intensity_);
+      desc.lights_.push_back(light);
+    }
+    else {
+      static const std::pair<const char *, std::pair<Shape, int>> shapes[] = {
+        {"plane", {Shape::Plane, 6}}, {"sphere", {Shape::Sphere, 4}},
+        {"cuboid", {Shape::Cuboid, 6}}, {"tetrahedron", {Shape::Tetrahedron, 12}}};
+      const auto shape = std::find_if(std::begin(shapes), std::end(shapes),
+                                      [&](const auto &s) { return tag == s.first; });
+      if (shape == std::end(shapes) && tag != "mesh") return fail("unknown statement " + tag);
+      if (!(in >> name)) return fail("expected a material");
+      const auto mat = std::find(desc.material_names_.begin(), desc.material_names_.end(), name);
+      if (mat == desc.material_names_.end()) return fail("unknown material " + name);
+      const uint32_t material = uint32_t(mat - desc.material_names_.begin());
+      if (prototype && desc.materials_[material]->emissive_) return fail("no emitters in a prototype");
+
+      if (tag == "mesh") {
+        std::string obj;
+        if (!(in >> obj)) return fail("expected an OBJ file");
+        real scale = 1;
+        Vec3 offset = Vec3::Zero();
+        if (in >> scale) read(in, offset.data(), 3);
+        Mat4 transform = Mat4::Identity();
+        transform.topLeftCorner<3, 3>() *= scale;
+        transform.topRightCorner<3, 1>() = offset;
+        const std::string mesh_path = (std::filesystem::path(path).parent_path() / obj).string();
+        auto mesh = TriangleMesh::LoadOBJ(desc.materials_[material].get(), mesh_path, transform);
+        if (!mesh) return fail("cannot load mesh");
+        desc.files_.push_back(mesh_path);
+        desc.mesh_materials_.push_back(material);
+        desc.mesh_prototypes_.push_back(prototype);
+        desc.meshes_.push_back(std::move(mesh));
+        continue;
+      }
+
+      ObjectRecord object{shape->second.first, material, prototype, {}};
+      if (!read(in, object.params_, shape->second.second)) return fail("too few numbers");
+      desc.objects_.push_back(object);
+    }
+  }
+  if (prototype) return fail("prototype without end");
+  return true;
+}
+
+// Appends raw bytes, padded to 8.
+void Put(std::string &out, const void *data, size_t size)
+{
+  out.append(static_cast<const char *>(data), size);
+  out.resize((out.size() + 7) / 8 * 8, '\0');
+}
+
+bool WriteCompiled(const std::string &path, const SceneDesc &desc)
+{
+  Header header = {};
+  std::memcpy(header.magic_, MAGIC_, sizeof(MAGIC_));
+  header.version_ = VERSION_;
+  header.real_size_ = sizeof(real);
+  header.stamp_ = Stamp(desc.files_);
+  header.files_ = uint32_t(desc.files_.size());
+  header.materials_ = uint32_t(desc.materials_.size());
+  header.objects_ = uint32_t(desc.objects_.size());
+  header.lights_ = uint32_t(desc.lights_.size());
+  header.meshes_ = uint32_t(desc.meshes_.size());
+  header.prototypes_ = desc.prototypes_;
+  header.instances_ = uint32_t(desc.instances_.size());
+  for (int i = 0; i < 3; ++i) header.ambient_[i] = desc.ambient_[i];
+  header.camera_ = desc.camera_;
+
+  std::string out;
+  Put(out, &header, sizeof(header));
+  for (const auto &strings : {&desc.files_, &desc.material_names_}) {
+    for (const std::string &s : *strings) {
+      const uint32_t size = uint32_t(s.size());
+      Put(out, &size, sizeof(size));
+      Put(out, s.data(), s.size());
+    }
+  }
+  for (const auto &mat : desc.materials_) {
+    MaterialRecord record = {};
+    for (int i = 0; i < 3; ++i) {
+      record.k_d_[i] = mat->k_d_[i];
+      record.k_s_[i] = mat->k_s_[i];
+    }
+    record.alpha_ = mat->alpha_;
+    record.emissive_ = mat->emissive_;
+    Put(out, &record, sizeof(record));
+  }
+  Put(out, desc.objects_.data(), desc.objects_.size() * sizeof(ObjectRecord));
+  Put(out, desc.lights_.data(), desc.lights_.size() * sizeof(LightRecord));
+  Put(out, desc.instances_.data(), desc.instances_.size() * sizeof(InstanceRecord));
+  for (size_t m = 0; m < desc.meshes_.size(); ++m) {
+    const TriangleMesh::Arrays a = desc.meshes_[m]->GetArrays();
+    const MeshRecord record{desc.mesh_materials_[m], desc.mesh_prototypes_[m], a.vertices_, a.triangles_, a.nodes_count_};
+    Put(out, &record, sizeof(record));
+    for (const real *v : {a.vx_, a.vy_, a.vz_}) Put(out, v, sizeof(real) * a.vertices_);
+    for (const int *i : {a.i0_, a.i1_, a.i2_}) Put(out, i, sizeof(int) * a.triangles_);
+    for (const real *n : {a.nx_, a.ny_, a.nz_}) Put(out, n, sizeof(real) * a.triangles_);
+    Put(out, a.nodes_, sizeof(BVH::Node) * a.nodes_count_);
+    Put(out, a.indices_, sizeof(int) * a.triangles_);
+  }
+
+  // written aside and renamed, so that a reader never maps half a file
+  const std::string temp = path + ".tmp";
+  {
+    std::ofstream file(temp, std::ios::binary);
+    if (!file.write(out.data(), std::streamsize(out.size()))) return false;
+  }
+  std::error_code ec;
+  std::filesystem::rename(temp, path, ec);
+  return !ec;
+}
+
+// Walks the mapped compiled file, nullptr once it runs out.
+class Cursor
+{
+public:
+
+  Cursor(const void *data, size_t size) : p_(static_cast<const char *>(data)), end_(p_ + size) { }
+
+  template <typename T>
+  const T *Take(size_t count = 1)
+  {
+    const size_t size = sizeof(T) * count;
+    if (!p_ || size_t(end_ - p_) < size) {
+      p_ = nullptr;
+      return nullptr;
+    }
+    const T *data = reinterpret_cast<const T *>(p_);
+    p_ += (size + 7) / 8 * 8;
+    if (p_ > end_) p_ = end_;
+    return data;
+  }
+
+  bool TakeString(std::string &s)
+  {
+    const uint32_t *size = Take<uint32_t>();
+    const char *chars = size ? Take<char>(*size) : nullptr;
+    if (!chars) return false;
+    s.assign(chars, *size);
+    return true;
+  }
+
+private:
+
+  const char *p_;
+  const char *end_;
+};
+
+// false if the compiled file is missing, stale or broken
+bool ReadCompiled(const std::string &path, SceneDesc &desc)
+{
+  const MappedFile file(path);
+  if (!file.Valid()) return false;
+  Cursor cursor(file.Data(), file.Size());
+  const Header *header = cursor.Take<Header>();
+  if (!header || std::memcmp(header->magic_, MAGIC_, sizeof(MAGIC_)) != 0 || header->version_ != VERSION_ ||
+      header->real_size_ != sizeof(real))
+    return false;
+
+  desc.files_.resize(header->files_);
+  desc.material_names_.resize(header->materials_);
+  for (std::string &s : desc.files_)
+    if (!cursor.TakeString(s)) return false;
+  if (Stamp(desc.files_) != header->stamp_) return false;
+  for (std::string &s : desc.material_names_)
+    if (!cursor.TakeString(s)) return false;
+
+  desc.ambient_ = Color(header->ambient_[0], header->ambient_[1], header->ambient_[2]);
+  desc.camera_ = header->camera_;
+  for (uint32_t i = 0; i < header->materials_; ++i) {
+    const MaterialRecord *r = cursor.Take<MaterialRecord>();
+    if (!r) return false;
+    const Color k_d(r->k_d_[0], r->k_d_[1], r->k_d_[2]);
+    if (r->emissive_) desc.materials_.push_back(std::make_unique<Material>(k_d, true));
+    else desc.materials_.push_back(std::make_unique<Material>(k_d, Color(r->k_s_[0], r->k_s_[1], r->k_s_[2]), r->alpha_));
+  }
+  const ObjectRecord *objects = cursor.Take<ObjectRecord>(header->objects_);
+  const LightRecord *lights = cursor.Take<LightRecord>(header->lights_);
+  const InstanceRecord *instances = cursor.Take<InstanceRecord>(header->instances_);
+  if (!objects || !lights || !instances) return false;
+  desc.objects_.assign(objects, objects + header->objects_);
+  desc.lights_.assign(lights, lights + header->lights_);
+  desc.prototypes_ = header->prototypes_;
+  desc.instances_.assign(instances, instances + header->instances_);
+
+  for (uint32_t m = 0; m < header->meshes_; ++m) {
+    const MeshRecord *r = cursor.Take<MeshRecord>();
+    if (!r || r->material_ >= header->materials_ || r->prototype_ > header->prototypes_) return false;
+    TriangleMesh::Arrays a;
+    a.vertices_ = r->vertices_;
+    a.triangles_ = r->triangles_;
+    a.nodes_count_ = r->nodes_;
+    a.vx_ = cursor.Take<real>(a.vertices_);
+    a.vy_ = cursor.Take<real>(a.vertices_);
+    a.vz_ = cursor.Take<real>(a.vertices_);
+    a.i0_ = cursor.Take<int>(a.triangles_);
+    a.i1_ = cursor.Take<int>(a.triangles_);
+    a.i2_ = cursor.Take<int>(a.triangles_);
+    a.nx_ = cursor.Take<real>(a.triangles_);
+    a.ny_ = cursor.Take<real>(a.triangles_);
+    a.nz_ = cursor.Take<real>(a.triangles_);
+    a.nodes_ = cursor.Take<BVH::Node>(a.nodes_count_);
+    a.indices_ = cursor.Take<int>(a.triangles_);
+    if (!a.indices_) return false;
+    desc.mesh_materials_.push_back(r->material_);
+    desc.mesh_prototypes_.push_back(r->prototype_);
+    desc.meshes_.push_back(std::make_unique<TriangleMesh>(desc.materials_[r->material_].get(), a));
+  }
+  for (const ObjectRecord &object : desc.objects_)
+    if (object.material_ >= header->materials_ || object.prototype_ > header->prototypes_) return false;
+  for (const InstanceRecord &instance : desc.instances_)
+    if (instance.prototype_ >= header->prototypes_) return false;
+  return true;
+}
+
+void Instantiate(SceneDesc &desc, Scene &scene)
+{
+  std::vector<const Material *> mats;
+  for (size_t i = 0; i < desc.materials_.size(); ++i) {
+    mats.push_back(desc.materials_[i].get());
+    scene.mats_[desc.material_names_[i]] = std::move(desc.materials_[i]);
+  }
+  // the scene's objects, then those of each prototype
+  std::vector<std::vector<std::unique_ptr<Object>>> groups(desc.prototypes_ + 1);
+  for (const ObjectRecord &o : desc.objects_) {
+    const real *p = o.params_;
+    const Material *mat = mats[o.material_];
+    auto &objs = groups[o.prototype_];
+    switch (o.shape_) {
+    case Shape::Plane:
+      objs.emplace_back(std::make_unique<Plane>(mat, Vec3(p[0], p[1], p[2]), Vec3(p[3], p[4], p[5])));
+      break;
+    case Shape::Sphere:
+      objs.emplace_back(std::make_unique<Sphere>(mat, Vec3(p[0], p[1], p[2]), p[3]));
+      break;
+    case Shape::Cuboid:
+      objs.emplace_back(std::make_unique<Cuboid>(mat, Vec3(p[0], p[1], p[2]), p[3], p[4], p[5]));
+      break;
+    case Shape::Tetrahedron:
+      objs.emplace_back(std::make_unique<Tetrahedron>(
+        mat, Vec3(p[0], p[1], p[2]), Vec3(p[3], p[4], p[5]), Vec3(p[6], p[7], p[8]), Vec3(p[9], p[10], p[11])));
+      break;
+    }
+  }
+  for (size_t m = 0; m < desc.meshes_.size(); ++m)
+    groups[desc.mesh_prototypes_[m]].emplace_back(std::move(desc.meshes_[m]));
+
+  scene.objs_ = std::move(groups[0]);
+  std::vector<std::shared_ptr<const Prototype>> prototypes;
+  for (uint32_t k = 0; k < desc.prototypes_; ++k)
+    prototypes.push_back(std::make_shared<Prototype>(std::move(groups[k + 1])));
+  for (const InstanceRecord &instance : desc.instances_) {
+    Mat4 transform = Mat4::Identity();
+    for (int r = 0; r < 3; ++r)
+      for (int c = 0; c < 4; ++c) transform(r, c) = instance.transform_[4 * r + c];
+    scene.objs_.emplace_back(std::make_unique<Instance>(prototypes[instance.prototype_], transform));
+  }
+  for (const LightRecord &l : desc.lights_) {
+    scene.lights_.emplace_back(std::make_unique<Light>(
+      Vec3(l.position_[0], l.position_[1], l.position_[2]),
+      Color(l.intensity_[0], l.intensity_[1], l.intensity_[2])));
+  }
+  scene.ambient_light_ = desc.ambient_;
+}
+
+}
+
+bool LoadScene(const std::string &path, Scene &scene, CameraSetup &camera)
+{
+  const std::string compiled = path + ".bin";
+  SceneDesc desc;
+  if (ReadCompiled(compiled, desc)) {
+    spdlog::info("loaded compiled scene {}", compiled);
+  }
+  else {
+    desc = SceneDesc();
+    if (!ParseText(path, desc)) return false;
+    if (!WriteCompiled(compiled, desc)) spdlog::warn("cannot write compiled scene {}", compiled);
+  }
+  camera = desc.camera_;
+  Instantiate(desc, scene);
+  return true;
+}
+
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "common/mathtype.h"
+#include "graphics/scene.h"
+
+#include <string>
+
+namespace VCL {
+
+// Camera placement of a scene file, as passed to Camera::InitData.
+struct CameraSetup
+{
+  float fovy_ = 0.25f * PI_;
+  float radius_ = 3.6f;
+  float phi_ = 0;
+  float theta_ = 0.5f * PI_;
+  Vec3f target_ = Vec3f(0, 1.5f, -2);
+};
+
+// Loads a scene file (see scenefile.cpp for the format) into scene, which
+// must be empty, and camera; call scene.Build() afterwards. The parsed scene,
+// meshes with their BVHs included, is also written to <path>.bin, which is
+// memory mapped instead of parsing again while neither the scene file nor
+// its meshes change. Errors are logged.
+bool LoadScene(const std::string &path, Scene &scene, CameraSetup &camera);
+
+}
@@ -0,0 +1,160 @@
+#include "wavefront.h"
+
+#include "graphics/packet.h"
+#include "common/stats.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace VCL::GlobIllum {
+
+namespace {
+
+int Octant(const Vec3 &dir)
+{
+  return (dir[0] < 0) | (dir[1] < 0) << 1 | (dir[2] < 0) << 2;
+}
+
+// emitters first, then mirrors, glossy and diffuse materials
+int Lobes(const Material *const mat)
+{
+  return mat->emissive_ ? 0 : mat->alpha_ < 0 ? 1 : mat->k_s_.any() ? 2 : 3;
+}
+
+}
+
+int Wavefront::Add(const Ray &ray, const HitRecord &hit, const Sampler &sampler)
+{
+  paths_.emplace_back(ray, hit, sampler);
+  return int(paths_.size()) - 1;
+}
+
+void Wavefront::Trace(const Scene &scene, const TraceParams &params, Color *out)
+{
+  live_.resize(paths_.size());
+  std::iota(live_.begin(), live_.end(), 0);
+  for (int depth = 0; !live_.empty(); depth++) {
+    if (depth > 0) Intersect(scene, depth);
+    Shade(scene, params, depth);
+    Occlude(scene);
+  }
+  for (size_t i = 0; i < paths_.size(); ++i) out[i] = paths_[i].color_;
+  paths_.clear();
+}
+
+void Wavefront::Intersect(const Scene &scene, const int depth)
+{
+  // only counted by the statistics
+  (void)depth;
+  // counting sort by octant, so that the rays of a packet point the same way
+  int begin[9] = {};
+  for (const int p : live_) ++begin[Octant(paths_[p].ray_.dir_) + 1];
+  std::partial_sum(begin, begin + 9, begin);
+  scratch_.resize(live_.size());
+  for (const int p : live_) scratch_[begin[Octant(paths_[p].ray_.dir_)]++] = p;
+
+  live_.clear();
+  for (size_t first = 0; first < scratch_.size(); first += SIMD_WIDTH_) {
+    const int n = int(std::min<size_t>(SIMD_WIDTH_, scratch_.size() - first));
+    RayPacket packet{};
+    for (int i = 0; i < n; ++i) {
+      const Ray &ray = paths_[scratch_[first + i]].ray_;
+      packet.ox_[i] = ray.ori_[0];
+      packet.oy_[i] = ray.ori_[1];
+      packet.oz_[i] = ray.ori_[2];
+      packet.dx_[i] = ray.dir_[0];
+      packet.dy_[i] = ray.dir_[1];
+      packet.dz_[i] = ray.dir_[2];
+    }
+    packet.active_ = (1 << n) - 1;
+    VCL_STAT(BounceRays, n);
+
+    HitRecord hits[SIMD_WIDTH_];
+    const int found = scene.IntersectPacket(packet, hits);
+    for (int i = 0; i < n; ++i) {
+      const int p = scratch_[first + i];
+      if (!(found >> i & 1)) {
+        VCL_STAT_PATH(Escaped, depth);
+        continue;
+      }
+      paths_[p].hit_ = hits[i];
+      live_.push_back(p);
+    }
+  }
+}
+
+void Wavefront::Shade(const Scene &scene, const TraceParams &params, const int depth)
+{
+  std::sort(live_.begin(), live_.end(), [&](const int a, const int b) {
+    const Material *ma = paths_[a].hit_.mat_, *mb = paths_[b].hit_.mat_;
+    const int la = Lobes(ma), lb = Lobes(mb);
+    return la != lb ? la < lb : std::less<const Material *>()(ma, mb);
+  });
+
+  shadows_.clear();
+  scratch_.clear();
+  for (size_t begin = 0, end; begin < live_.size(); begin = end) {
+    const Material *mat = paths_[live_[begin]].hit_.mat_;
+    for (end = begin + 1; end < live_.size() && paths_[live_[end]].hit_.mat_ == mat; ++end) { }
+
+    if (mat->emissive_) {
+      for (size_t i = begin; i < end; ++i) {
+        Path &path = paths_[live_[i]];
+        real w = 1;
+        if (path.bsdf_pdf_ > 0) {
+          const real light_pdf = scene.EmitterPdf(path.hit_.obj_) * path.hit_.obj_->SurfacePdf(path.last_pos_, path.hit_);
+          w = PowerHeuristic(path.bsdf_pdf_, light_pdf);
+        }
+        VCL_STAT_PATH(Emissive, depth + 1);
+        path.color_ += path.throughput_ * mat->k_d_ * w;
+      }
+      continue;
+    }
+
+    for (size_t i = begin; i < end; ++i) {
+      const int p = live_[i];
+      Path &path = paths_[p];
+      const HitRecord &hit = path.hit_;
+      const Vec3 wi = -path.ray_.dir_;
+      const real cos_i = hit.n_.dot(wi);
+
+      // next-event estimation, the shadow ray is tested in Occlude()
+      real emitter_pdf;
+      const Object *emitter = scene.SampleEmitter(path.sampler_.Next1D(), emitter_pdf);
+      const Vec2 u = path.sampler_.Next2D();
+      Vec3 light_pos;
+      const real dir_pdf = emitter ? emitter->SampleSurface(hit.pos_, u, light_pos) : 0;
+      if (dir_pdf > 0 && Scene::InRoom(light_pos)) {
+        const Vec3 to_light = light_pos - hit.pos_;
+        const real dist = to_light.norm();
+        const Vec3 wo = to_light / dist;
+        real pdf;
+        const Color f = Eval(mat, hit.n_, wi, wo, pdf);
+        if (f.any()) {
+          const real light_pdf = emitter_pdf * dir_pdf;
+          shadows_.push_back({Ray(hit.pos_ + 0.01 * wo, wo), (dist - real(0.01)) * real(0.999),
+                              path.throughput_ * cos_i * f * emitter->Mat()->k_d_ * (PowerHeuristic(light_pdf, pdf) / light_pdf),
+                              p});
+        }
+      }
+
+      Color weight(0, 0, 0);
+      const Vec3 dir = Sample(mat, hit.n_, wi, weight, path.bsdf_pdf_, path.sampler_);
+      path.throughput_ *= weight * cos_i;
+      if (!Survive(path.throughput_, depth + 1, params, path.sampler_)) continue;
+      path.last_pos_ = hit.pos_;
+      path.ray_ = Ray(hit.pos_ + 0.01 * dir, dir.normalized());
+      scratch_.push_back(p);
+    }
+  }
+  live_.swap(scratch_);
+}
+
+void Wavefront::Occlude(const Scene &scene)
+{
+  for (const Shadow &shadow : shadows_) {
+    if (!scene.Occluded(shadow.ray_, shadow.tmax_)) paths_[shadow.path_].color_ += shadow.radiance_;
+  }
+}
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "graphics/globillum.h"
+
+#include <vector>
+
+namespace VCL::GlobIllum {
+
+// Path tracing of a batch of paths in stages instead of one path after the
+// other. Each bounce intersects all live paths as packets, sorted by
+// direction octant; shades them binned by material, so that consecutive
+// paths read the same material and take the same branches; and then tests
+// all of their shadow rays. Every path gets the same estimate as from
+// PathTrace with the same sampler.
+class Wavefront
+{
+public:
+
+  // Queues a path whose camera ray already found hit, returns its index in
+  // the output of Trace().
+  int Add(const Ray &ray, const HitRecord &hit, const Sampler &sampler);
+
+  int Size() const { return int(paths_.size()); }
+
+  // Traces all queued paths to their end, writes the radiance of the i-th
+  // to out[i] and empties the queue.
+  void Trace(const Scene &scene, const TraceParams &params, Color *out);
+
+private:
+
+  struct Path
+  {
+    Ray ray_;
+    HitRecord hit_;
+    Sampler sampler_;
+    Color color_ = Color::Zero();
+    Color throughput_ = Color::Ones();
+    // pdf of the bounce that led here, 0 if light sampling could not have found it
+    real bsdf_pdf_ = 0;
+    Vec3 last_pos_;
+
+    Path(const Ray &ray, const HitRecord &hit, const Sampler &sampler) :
+      ray_(ray), hit_(hit), sampler_(sampler)
+    { }
+  };
+
+  // a shadow ray and what it adds to its path if nothing blocks it
+  struct Shadow
+  {
+    Ray ray_;
+    real tmax_;
+    Color radiance_;
+    int path_;
+  };
+
+  void Intersect(const Scene &scene, const int depth);
+  void Shade(const Scene &scene, const TraceParams &params, const int depth);
+  void Occlude(const Scene &scene);
+
+  std::vector<Path> paths_;
+  // indices of the paths still going, in the order of the current stage
+  std::vector<int> live_;
+  std::vector<int> scratch_;
+  std::vector<Shadow> shadows_;
+};
+
+}
@@ -1,7 +1,12 @@
 #include <iostream>
+#include <vector>
 #include "renderer/renderer.h"
 #include <spdlog/spdlog.h>
+#ifdef _WIN32
 #include "common/getopt.h"
+#else
+#include <getopt.h>
+#endif
 #include "common/helperfunc.h"
 
 using namespace VCL;
@@ -11,6 +16,25 @@ int lightMode = -1;
 int cameraMode = -1;
 std::string tracing = "ray";
 bool tracingMode = false;
+bool wavefront = false;
+int width = 800;
+int height = 600;
+int spp = 64;
+int depth = 10;
+float noise = 0.02f;
+bool denoise = false;
+bool aov = false;
+std::string checkpoint;
+double checkpoint_every = 60.0;
+double preview_fps = 30.0;
+std::string stats;
+std::string scene;
+uint64_t seed = 0;
+int part = 0;
+int parts = 1;
+bool merge = false;
+std::vector<std::string> films;
+std::string output;
 
 void PrintHelp()
 {
@@ -19,18 +43,64 @@ void PrintHelp()
             "--light <mode>:      Set mode of light (0, 1, 2, 3)\n"
             "--camera <mode>:     Set view of camera (0, 1, 2, 3)\n"
             "--tracing <mode>:    Set tracing mode (ray, path)\n"
-            "--help:              Show help\n";
+            "--wavefront:         Path trace the paths of a tile in stages, sorted by material\n"
+            "--scene <file>:      Load the scene from file instead of the built-in room\n"
+            "--width <pixels>:    Set image width (default 800)\n"
+            "--height <pixels>:   Set image height (default 600)\n"
+            "--spp <samples>:     Set maximum samples per pixel of offline mode (default 64)\n"
+            "--noise <error>:     Stop sampling pixels below this relative error (default 0.02, 0 = never)\n"
+            "--depth <bounces>:   Set maximum path length (default 10)\n"
+            "--denoise:           Filter the image guided by albedo, normal and depth\n"
+            "--aov:               Also save albedo, normal and depth of offline mode (.hdr)\n"
+            "--checkpoint <file>: Resume from and periodically save the samples to file\n"
+            "                     (resumes only the same image, e.g. with --fix)\n"
+            "--checkpoint-every <seconds>: Set time between checkpoints (default 60)\n"
+            "--seed <number>:     Seed sampling and the object layout (default 0 = random layout)\n"
+            "--part <i>/<n>:      Render the i-th of n disjoint sample ranges of --spp and save\n"
+            "                     the raw film to the output file, for merge; every pixel gets\n"
+            "                     its full range, --noise is ignored\n"
+            "--preview-fps <fps>: Frame rate held by coarser previews while the camera moves\n"
+            "                     (default 30, 0 = always refine at full resolution)\n"
+            "--stats <file>:      Save render statistics to file at exit (needs xmake f --stats=y)\n"
+            "--output <file>:     Render offline and save to file (.png, .hdr)\n"
+            "--help:              Show help\n"
+            "\n"
+            "merge --output <file> [--denoise] [--aov] <film>...:\n"
+            "                     Combine the films of --part renders of the same --spp into one\n"
+            "                     image; parts of different splits must not overlap\n";
     exit(1);
 }
 
 void ProcessArgs(int argc, char** argv)
 {
-    const char* const short_opts = "fl:c:t:h";
+    if (argc > 1 && std::string(argv[1]) == "merge")
+    {
+        merge = true;
+        --argc;
+        ++argv;
+    }
+    const char* const short_opts = "fl:c:t:wi:W:H:s:n:d:DAk:K:P:S:e:p:o:h";
     const option long_opts[] = {
             {"fix", no_argument, nullptr, 'f'},
             {"light", required_argument, nullptr, 'l'},
             {"camera", required_argument, nullptr, 'c'},
             {"tracing", required_argument, nullptr, 't'},
+            {"wavefront", no_argument, nullptr, 'w'},
+            {"scene", required_argument, nullptr, 'i'},
+            {"width", required_argument, nullptr, 'W'},
+            {"height", required_argument, nullptr, 'H'},
+            {"spp", required_argument, nullptr, 's'},
+            {"noise", required_argument, nullptr, 'n'},
+            {"depth", required_argument, nullptr, 'd'},
+            {"denoise", no_argument, nullptr, 'D'},
+            {"aov", no_argument, nullptr, 'A'},
+            {"checkpoint", required_argument, nullptr, 'k'},
+            {"checkpoint-every", required_argument, nullptr, 'K'},
+            {"preview-fps", required_argument, nullptr, 'P'},
+            {"stats", required_argument, nullptr, 'S'},
+            {"seed", required_argument, nullptr, 'e'},
+            {"part", required_argument, nullptr, 'p'},
+            {"output", required_argument, nullptr, 'o'},
             {"help", no_argument, nullptr, 'h'},
             {nullptr, no_argument, nullptr, 0}
     };
@@ -88,6 +158,106 @@ void ProcessArgs(int argc, char** argv)
             }
             break;
 
+        case 'w':
+            wavefront = true;
+            break;
+
+        case 'i':
+            scene = std::string(optarg);
+            break;
+
+        case 'W':
+        case 'H':
+            (opt == 'W' ? width : height) = std::stoi(optarg);
+            if ((opt == 'W' ? width : height) <= 0)
+            {
+              std::cout << "Image size should be positive, not " << optarg << "\n" << std::endl;
+              exit(1);
+            }
+            break;
+
+        case 's':
+            spp = std::stoi(optarg);
+            if (spp <= 0)
+            {
+              std::cout << "Samples per pixel should be positive, not " << spp << "\n" << std::endl;
+              exit(1);
+            }
+            break;
+
+        case 'n':
+            noise = std::stof(optarg);
+            if (noise < 0)
+            {
+              std::cout << "Noise threshold should not be negative, not " << noise << "\n" << std::endl;
+              exit(1);
+            }
+            break;
+
+        case 'd':
+            depth = std::stoi(optarg);
+            if (depth <= 0)
+            {
+              std::cout << "Path length should be positive, not " << depth << "\n" << std::endl;
+              exit(1);
+            }
+            break;
+
+        case 'D':
+            denoise = true;
+            std::cout << "Denoise is set to true\n" << std::endl;
+            break;
+
+        case 'A':
+            aov = true;
+            break;
+
+        case 'k':
+            checkpoint = std::string(optarg);
+            break;
+
+        case 'K':
+            checkpoint_every = std::stod(optarg);
+            if (checkpoint_every <= 0)
+            {
+              std::cout << "Checkpoint interval should be positive, not " << checkpoint_every << "\n" << std::endl;
+              exit(1);
+            }
+            break;
+
+        case 'P':
+            preview_fps = std::stod(optarg);
+            if (preview_fps < 0)
+            {
+              std::cout << "Preview frame rate should not be negative, not " << preview_fps << "\n" << std::endl;
+              exit(1);
+            }
+            break;
+
+        case 'S':
+            stats = std::string(optarg);
+#ifndef VCL_STATS
+            std::cout << "Statistics are not built in, rebuild with xmake f --stats=y" << "\n" << std::endl;
+#endif
+            break;
+
+        case 'e':
+            seed = std::stoull(optarg);
+            break;
+
+        case 'p':
+            if (std::sscanf(optarg, "%d/%d", &part, &parts) != 2 || parts <= 0 || part < 0 || part >= parts)
+            {
+              std::cout << "Part should be i/n with 0 <= i < n, not " << optarg << "\n" << std::endl;
+              exit(1);
+            }
+            break;
+
+        case 'o':
+            output = std::string(optarg);
+            std::cout << "Render offline to: " << output << "\n" << std::endl;
+            break;
+
         case 'h': // -h or --help
         case '?': // Unrecognized option
         default:
@@ -95,6 +265,20 @@ void ProcessArgs(int argc, char** argv)
             break;
         }
     }
+
+    if (merge)
+    {
+        films.assign(argv + optind, argv + argc);
+        if (films.empty() || output.empty())
+        {
+          std::cout << "Merge needs an output file and at least one film" << "\n" << std::endl;
+          exit(1);
+        }
+    }
+    else if (optind < argc)
+    {
+        PrintHelp();
+    }
 }
 
 int main(int argc, char **argv) {
@@ -105,14 +289,63 @@ int main(int argc, char **argv) {
   spdlog::set_level(spdlog::level::debug);
 #endif
   ProcessArgs(argc, argv);
+  if (merge) {
+    // the image's size comes from the films, the scene isn't needed
+    CheckpointHeader header;
+    if (!ReadCheckpointHeader(films.front(), header)) {
+      spdlog::error("{} is not a film", films.front());
+      return 1;
+    }
+    Renderer renderer;
+    renderer.denoise_ = denoise;
+    renderer.aov_ = aov;
+    renderer.InitFilm(header.width_, header.height_);
+    const bool merged = renderer.Merge(films, output);
+    renderer.Destroy();
+    return merged ? 0 : 1;
+  }
   std::cout << "is position fix: " << std::boolalpha << isFix << "\n"
             << "light mode: " << lightMode << "\n"
             << "camera mode: " << cameraMode << "\n"
             << "tracing mode: " << tracing << " tracing\n";
+  if (output.empty() && !HasDisplay()) {
+    output = "render.png";
+    spdlog::info("no display available, rendering offline to {}", output);
+  }
+  if (parts > 1 && output.empty()) {
+    spdlog::error("--part needs --output for the film");
+    return 1;
+  }
+  const bool offline = !output.empty();
   Renderer renderer;
-  renderer.Init("Visual Computing", 800, 600,
-                isFix, lightMode, cameraMode, tracingMode);
-  renderer.MainLoop();
+  renderer.trace_params_.max_depth_ = depth;
+  renderer.wavefront_ = wavefront;
+  renderer.noise_threshold_ = noise;
+  renderer.denoise_ = denoise;
+  renderer.aov_ = aov;
+  renderer.checkpoint_path_ = checkpoint;
+  renderer.checkpoint_interval_ = checkpoint_every;
+  renderer.preview_fps_ = preview_fps;
+  renderer.stats_path_ = stats;
+  renderer.seed_ = seed;
+  renderer.scene_path_ = scene;
+  if (offline) renderer.total_samples_ = uint32_t(spp);
+  if (parts > 1) {
+    // a part stopping on its own error estimate would leave holes in the
+    // sample ranges that the merged film is made of
+    renderer.noise_threshold_ = 0;
+    spp = (spp + parts - 1) / parts;
+    renderer.sample_offset_ = uint32_t(part * spp);
+    renderer.save_film_ = true;
+  }
+  if (offline) renderer.sample_count_ = uint32_t(spp);
+  if (!renderer.Init("Visual Computing", width, height,
+                     isFix, lightMode, cameraMode, tracingMode, offline)) {
+    renderer.Destroy();
+    return 1;
+  }
+  if (offline) renderer.RenderOffline(spp, output);
+  else renderer.MainLoop();
   renderer.Destroy();
   return 0;
 }
\ No newline at end of file
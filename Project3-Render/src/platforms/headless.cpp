@@ -0,0 +1,45 @@
+#include <cassert>
+#include <spdlog/spdlog.h>
+
+#include "graphics/platform.h"
+#include "renderer/renderer.h"
+
+namespace VCL {
+// Window-less backend for machines without a display server. Frames are
+// never presented; the renderer is expected to run in offline mode and write
+// its result to disk.
+class HeadlessWindow : public VWindow {
+ public:
+  virtual void Init(const std::string& title, int& width, int& height,
+                    void* renderer);
+  virtual void Destroy();
+  virtual void DrawBuffer(Framebuffer* buffer);
+};
+
+void InitPlatform() {}
+
+void DestroyPlatform() {}
+
+bool HasDisplay() { return false; }
+
+void PollInputEvents() {}
+
+VWindow* CreateVWindow(const std::string& title, int& width, int& height,
+                       void* renderer) {
+  HeadlessWindow* window = new HeadlessWindow;
+  window->Init(title, width, height, renderer);
+  return window;
+}
+
+void HeadlessWindow::Init(const std::string& title, int& width, int& height,
+                          void* /*renderer*/) {
+  assert(width > 0 && height > 0);
+  spdlog::warn("no display available, frames of \"{}\" will not be shown",
+               title);
+  surface_ = new Image(width, height, 4);
+}
+
+void HeadlessWindow::Destroy() {}
+
+void HeadlessWindow::DrawBuffer(Framebuffer* /*buffer*/) {}
+};  // namespace VCL
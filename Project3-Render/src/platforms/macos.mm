@@ -220,6 +220,8 @@ void MacWindow::Init(const std::string& title, int& width, int& height, void* re
   [handle_ makeKeyAndOrderFront:nil];
 }
 
+bool HasDisplay() { return true; }
+
 VWindow* CreateVWindow(const std::string& title, int& width, int& height,
                        void* renderer) {
   assert(NSApp && width > 0 && height > 0);
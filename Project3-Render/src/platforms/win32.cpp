@@ -34,7 +34,7 @@ static LRESULT CALLBACK ProcessMessage(HWND hWnd, UINT uMsg, WPARAM wParam,
   } else if (uMsg == WM_CLOSE) {
     renderer->window_->should_close_ = true;
     return 0;
-  } /* else if (uMsg == WM_LBUTTONDOWN) {
+  } else if (uMsg == WM_LBUTTONDOWN) {
     POINT point;
     GetCursorPos(&point);
     ScreenToClient(reinterpret_cast<WinWindow*>(renderer->window_)->handle_,
@@ -70,7 +70,7 @@ static LRESULT CALLBACK ProcessMessage(HWND hWnd, UINT uMsg, WPARAM wParam,
   } else if (uMsg == WM_MOUSEWHEEL) {
     float offset = GET_WHEEL_DELTA_WPARAM(wParam) / (float)WHEEL_DELTA;
     renderer->camera_->Scale(offset);
-  }*/ else {
+  } else {
     return DefWindowProc(hWnd, uMsg, wParam, lParam);
   }
   return 0;
@@ -102,6 +102,8 @@ void DestroyPlatform() {
   g_initialized = 0;
 }
 
+bool HasDisplay() { return true; }
+
 void PollInputEvents() {
   MSG message;
   while (PeekMessage(&message, NULL, 0, 0, PM_REMOVE)) {
@@ -0,0 +1,76 @@
+#include "checkpoint.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+#include <spdlog/spdlog.h>
+
+#include "common/mappedfile.h"
+
+namespace VCL {
+bool CheckpointHeader::operator==(const CheckpointHeader& other) const {
+  return std::memcmp(this, &other, sizeof(CheckpointHeader)) == 0;
+}
+
+bool Checkpointer::WriteAsync(const std::string& path, const CheckpointHeader& header,
+                              const Film& film) {
+  if (pending_.valid()) {
+    if (pending_.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return false;
+    if (!pending_.get()) spdlog::error("failed to write checkpoint {}", path);
+  }
+  buffer_.resize(sizeof(CheckpointHeader) + film.StateSize());
+  std::memcpy(buffer_.data(), &header, sizeof(CheckpointHeader));
+  std::memcpy(buffer_.data() + sizeof(CheckpointHeader), film.State(), film.StateSize());
+
+  pending_ = std::async(std::launch::async, [this, path] {
+    const std::string temp = path + ".tmp";
+    std::FILE* file = std::fopen(temp.c_str(), "wb");
+    if (!file) return false;
+    const bool written = std::fwrite(buffer_.data(), 1, buffer_.size(), file) == buffer_.size();
+    if (std::fclose(file) != 0 || !written) return false;
+    std::error_code ec;
+    std::filesystem::rename(temp, path, ec);
+    return !ec;
+  });
+  return true;
+}
+
+bool Checkpointer::Wait() {
+  if (!pending_.valid()) return true;
+  return pending_.get();
+}
+
+bool ReadCheckpoint(const std::string& path, const CheckpointHeader& header, Film& film) {
+  const MappedFile file(path);
+  if (!file.Valid()) return false;
+  if (file.Size() != sizeof(CheckpointHeader) + film.StateSize() ||
+      !(*static_cast<const CheckpointHeader*>(file.Data()) == header)) {
+    spdlog::warn("checkpoint {} is from other settings, starting over", path);
+    return false;
+  }
+  film.LoadState(static_cast<const char*>(file.Data()) + sizeof(CheckpointHeader));
+  return true;
+}
+
+bool ReadCheckpointHeader(const std::string& path, CheckpointHeader& header) {
+  const MappedFile file(path);
+  if (!file.Valid() || file.Size() < sizeof(CheckpointHeader)) return false;
+  std::memcpy(&header, file.Data(), sizeof(CheckpointHeader));
+  return std::memcmp(header.magic_, CheckpointHeader().magic_, sizeof(header.magic_)) == 0;
+}
+
+bool MergeCheckpoint(const std::string& path, const CheckpointHeader& header, Film& film) {
+  const MappedFile file(path);
+  if (!file.Valid() || file.Size() != sizeof(CheckpointHeader) + film.StateSize()) return false;
+  CheckpointHeader other;
+  std::memcpy(&other, file.Data(), sizeof(CheckpointHeader));
+  other.sample_offset_ = header.sample_offset_;
+  other.sample_count_ = header.sample_count_;
+  if (!(other == header)) return false;
+  film.MergeState(static_cast<const char*>(file.Data()) + sizeof(CheckpointHeader));
+  return true;
+}
+};  // namespace VCL
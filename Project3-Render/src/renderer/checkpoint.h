@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "graphics/film.h"
+
+namespace VCL {
+// Fixed size header of a checkpoint file, followed by Film::State(). A
+// checkpoint only resumes a render whose header compares equal.
+struct CheckpointHeader {
+  char magic_[8] = {'V', 'C', 'L', 'C', 'K', 'P', 'T', '\0'};
+  uint32_t version_ = 2;
+  int32_t width_ = 0;
+  int32_t height_ = 0;
+  int32_t light_mode_ = 0;
+  int32_t camera_mode_ = 0;
+  int32_t tracing_mode_ = 0;
+  int32_t max_depth_ = 0;
+  // first sample index and samples per pixel from there, the range differs
+  // between the parts of a render
+  uint32_t sample_offset_ = 0;
+  uint32_t sample_count_ = 0;
+  // samples per pixel of the whole render the parts add up to
+  uint32_t total_samples_ = 0;
+  uint64_t seed_ = 0;
+  // HashBytes() of the objects' bounds and the camera, catches unfixed
+  // object layouts
+  uint64_t scene_hash_ = 0;
+  uint64_t state_size_ = 0;
+  // zero, keeps the film state aligned
+  uint8_t reserved_[56] = {};
+
+  bool operator==(const CheckpointHeader& other) const;
+};
+static_assert(sizeof(CheckpointHeader) == 128, "film state starts cache line aligned");
+
+// Writes checkpoints on a background thread. The film is copied on the
+// calling thread, which must keep other threads from adding samples during
+// the copy; the file is written next to path and renamed over it, so a
+// crash never leaves a torn checkpoint.
+class Checkpointer {
+ public:
+  ~Checkpointer() { Wait(); }
+
+  // false if the previous checkpoint is still being written
+  bool WriteAsync(const std::string& path, const CheckpointHeader& header, const Film& film);
+  // waits for the pending write, false if it failed
+  bool Wait();
+
+ private:
+  std::vector<char> buffer_;
+  std::future<bool> pending_;
+};
+
+// Memory maps path and loads its state into film if the header matches.
+bool ReadCheckpoint(const std::string& path, const CheckpointHeader& header, Film& film);
+
+bool ReadCheckpointHeader(const std::string& path, CheckpointHeader& header);
+
+// Adds the state of path to film if its header matches apart from the
+// sample range.
+bool MergeCheckpoint(const std::string& path, const CheckpointHeader& header, Film& film);
+};  // namespace VCL
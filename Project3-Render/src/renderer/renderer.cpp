@@ -1,13 +1,49 @@
 #include "renderer.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <limits>
+#include <numeric>
 #include <random>
+#include <thread>
+
+#include <spdlog/spdlog.h>
 
 #include "common/helperfunc.h"
+#include "common/sampler.h"
 #include "graphics/globillum.h"
+#include "graphics/image.h"
+#include "graphics/scenefile.h"
+#include "graphics/wavefront.h"
 
 namespace VCL {
-void Renderer::Init(const std::string& title, int width, int height,
-                    bool isFix, int lightMode, int cameraMode, bool tracingMode) {
+namespace {
+// samples before a pixel's variance estimate is trusted
+constexpr int MIN_SAMPLES_ = 64;
+// pixels of the largest tile
+constexpr int TILE_PIXELS_ = TILE_SIZE_ * TILE_SIZE_;
+// offline samples per pixel between two chances to checkpoint
+constexpr int ROUND_SAMPLES_ = 16;
+// seconds between two statistics reports
+constexpr double STATS_INTERVAL_ = 5.0;
+// tolerance of Reproject()'s depth test, relative to the distance
+constexpr float REPROJECT_DEPTH_ = 0.03f;
+// smallest cosine between a reprojected pixel's mean normal and the new one
+constexpr real REPROJECT_NORMAL_ = real(0.9);
+// smallest size of a new pixel, in old pixels, that may take over an old
+// pixel's samples; below it several new pixels would share them
+constexpr float REPROJECT_FOOTPRINT_ = 0.9f;
+// samples a pixel takes over at most, so that it gets at least as many of
+// its own before it may count as converged
+constexpr int REPROJECT_SAMPLES_ = MIN_SAMPLES_ / 2;
+// seconds without camera input after which previews give way to refinement
+constexpr double PREVIEW_HOLD_ = 0.2;
+}  // namespace
+
+bool Renderer::Init(const std::string& title, int width, int height,
+                    bool isFix, int lightMode, int cameraMode, bool tracingMode,
+                    bool offline) {
   width_ = width;
   height_ = height;
   isFix_ = isFix;
@@ -15,13 +51,47 @@ void Renderer::Init(const std::string& title, int width, int height,
   cameraMode_ = cameraMode;
   tracingMode_ = tracingMode;
   InitPlatform();
-  window_ = CreateVWindow(title, width_, height_, this);
-  framebuffer_ = new Framebuffer(width_, height_);
+  if (!offline) window_ = CreateVWindow(title, width_, height_, this);
+  InitFilm(width_, height_);
+  // the first hit cache pays off while the interactive loop keeps coming
+  // back to the same pixels; offline samples each take their own position
+  // instead of one of its GBuffer::JITTERS_
+  if (!offline) gbuffer_ = new GBuffer(width_, height_);
+  stats_start_ = stats_time_ = std::chrono::steady_clock::now();
 
   camera_ = new Camera;
+  if (!scene_path_.empty()) {
+    CameraSetup setup;
+    if (!LoadScene(scene_path_, scene_, setup)) return false;
+    camera_->InitData((float)width_ / height_, setup.fovy_, 1.0f, 1000.0f, setup.radius_,
+                      setup.phi_, setup.theta_, setup.target_);
+  } else {
+    BuildRoom();
+  }
+  scene_.Build();
+  spdlog::info("{} objects in {} BVH entries, {} batch kernels", scene_.objs_.size(), scene_.compiled_.Size(),
+               BatchKernels());
+  return true;
+}
+
+void Renderer::InitFilm(int width, int height) {
+  width_ = width;
+  height_ = height;
+  framebuffer_ = new Framebuffer(width_, height_);
+  film_ = new Film(width_, height_);
+  if (denoise_) denoiser_ = new Denoiser(width_, height_);
+  scheduler_ = new Scheduler;
+  tiles_ = MakeTiles(width_, height_);
+}
+
+void Renderer::BuildRoom() {
+  // the layout is reproducible with a seed, random otherwise
+  std::random_device device;
+  Sampler layout = seed_ ? Sampler(seed_, 1) : Sampler(device(), device());
+
   const float c_y = 1.5;
   const float c_z = 1.5 + 1.5 * std::sqrt(2);
-  if (cameraMode_ == -1) cameraMode_ = std::floor(rand01() * 4);
+  if (cameraMode_ == -1) cameraMode_ = std::floor(layout.Next1D() * 4);
   if (cameraMode_ == 0) 
   {
     camera_->InitData((float)width_ / height_, 0.25f * PI_, 1.0f, 1000.0f, c_z,
@@ -85,7 +155,7 @@ void Renderer::Init(const std::string& title, int width, int height,
 	const real dl = real(2) / 3;
 	const real rl = 5;
 	const real hl = std::sqrt(rl * rl - dl * dl);
-  if (lightMode_ == -1) lightMode_ = std::floor(rand01() * 4);
+  if (lightMode_ == -1) lightMode_ = std::floor(layout.Next1D() * 4);
   if (lightMode_ == 0)
   {
     objs.emplace_back(std::make_unique<Sphere>(
@@ -253,16 +323,16 @@ void Renderer::Init(const std::string& title, int width, int height,
   }
   else
   {
-    real c1 = rand01() + 0.5;
+    real c1 = layout.Next1D() + 0.5;
     objs.emplace_back(std::make_unique<Cuboid>(
       mats["wood"].get(),
       Vec3(c1, 1, real(-3.2)),
       real(.8), real(2.0), real(.8)));
-    real c2 = -rand01() / 5.0 - 0.9;
+    real c2 = -layout.Next1D() / 5.0 - 0.9;
     objs.emplace_back(std::make_unique<Sphere>(
       mats["metal"].get(),
       Vec3(c2, real(.8), -2), real(.8)));
-    real c3 = rand01() - 0.5;
+    real c3 = layout.Next1D() - 0.5;
     objs.emplace_back(std::make_unique<Tetrahedron>(
       mats["glaze"].get(),
       Vec3(c3, 0, -2),
@@ -274,92 +344,634 @@ void Renderer::Init(const std::string& title, int width, int height,
   scene_.ambient_light_ = Color(0.05, 0.05, 0.05);
 }
 
-void Renderer::Progress(int &x, int &y, Color **buffer, int **cnt, const bool MonteCarlo) {
+Color Renderer::Sample(const int x, const int y, const uint32_t index, const bool MonteCarlo) {
   const real dx = real(1) / width_;
 	const real dy = real(1) / height_;
 
   const real lx = dx * x;
   const real ly = dy * y;
 
-  const real sx = lx + rand01() * dx;
-  const real sy = ly + rand01() * dy;
+  Sampler sampler = Sampler::ForPixel(y * width_ + x, index, seed_);
+  const Vec2 jitter = sampler.Next2D();
+  const real sx = lx + jitter[0] * dx;
+  const real sy = ly + jitter[1] * dy;
 
+  VCL_STAT(CameraRays, 1);
   if (!MonteCarlo) {
-    buffer[y][x] += (GlobIllum::RayTrace(scene_, camera_->GenerateRay(sx, sy)) - buffer[y][x]) / (++cnt[y][x]);    
+    return GlobIllum::RayTrace(scene_, camera_->GenerateRay(sx, sy), sampler, trace_params_);
   }
   else {
-    buffer[y][x] += (GlobIllum::PathTrace(scene_, camera_->GenerateRay(sx, sy)) - buffer[y][x]) / (++cnt[y][x]);
+    return GlobIllum::PathTrace(scene_, camera_->GenerateRay(sx, sy), sampler, trace_params_);
+  }
+}
+
+int Renderer::FirstHits(const int* xs, const int* ys, const uint32_t* index, const int n,
+                        Sampler* samplers, RayPacket& packet, HitRecord* hits, Guide* guides) {
+  const real dx = real(1) / width_;
+  const real dy = real(1) / height_;
+
+  // with a G-buffer, camera rays cycle through its jitter positions
+  int pixel[SIMD_WIDTH_], jitter[SIMD_WIDTH_];
+  alignas(32) real sx[SIMD_WIDTH_] = {};
+  alignas(32) real sy[SIMD_WIDTH_] = {};
+  for (int i = 0; i < n; ++i) {
+    pixel[i] = ys[i] * width_ + xs[i];
+    jitter[i] = index[i] % GBuffer::JITTERS_;
+    samplers[i] = Sampler::ForPixel(pixel[i], index[i], seed_);
+    Vec2 u = samplers[i].Next2D();
+    // the first sample's stream provides the pixel's offset
+    if (gbuffer_) u = GBuffer::Jitter(jitter[i], Sampler::ForPixel(pixel[i], 0, seed_).Next2D());
+    sx[i] = dx * xs[i] + u[0] * dx;
+    sy[i] = dy * ys[i] + u[1] * dy;
   }
 
-  int idx = (y * width_ + x) * 4;
-  for (int i = 0; i < 3; i++) framebuffer_->color_[idx + i] = std::round(std::pow(std::clamp(buffer[y][x][i], 0.0f, 1.0f), 1 / 2.2f) * 255);
+  camera_->GeneratePacket(sx, sy, n, packet);
+  int found = 0, cached = 0;
+  for (int i = 0; i < n; ++i) {
+    if (!gbuffer_ || !gbuffer_->Lookup(pixel[i], jitter[i], packet.Lane(i), hits[i])) continue;
+    cached |= 1 << i;
+    if (hits[i].obj_) found |= 1 << i;
+  }
+  VCL_STAT(CachedCameraRays, Stats::Lanes(cached));
+  if (cached != packet.active_) {
+    HitRecord traced[SIMD_WIDTH_];
+    packet.active_ &= ~cached;
+    VCL_STAT(CameraRays, Stats::Lanes(packet.active_));
+    found |= scene_.IntersectPacket(packet, traced);
+    for (int i = 0; i < n; ++i) {
+      if (cached >> i & 1) continue;
+      hits[i] = traced[i];
+      if (gbuffer_) gbuffer_->Store(pixel[i], jitter[i], hits[i]);
+    }
+  }
 
-  x++;
-  if (x == width_) {
-    x = 0;
-    y++;
-    if (y == height_) y = 0;
+  if (guides) {
+    for (int i = 0; i < n; ++i) {
+      guides[i] = Guide();
+      if (!(found >> i & 1)) continue;
+      guides[i].albedo_ = hits[i].mat_->k_d_.min(1);
+      guides[i].normal_ = hits[i].n_;
+      guides[i].depth_ = hits[i].t_;
+    }
   }
+  return found;
 }
 
-void Renderer::MainLoop() {
-  // switch between ray tracing and path tracing
-  const bool MonteCarlo = tracingMode_;
+void Renderer::SamplePacket(const int* xs, const int* ys, const uint32_t* index, const int n,
+                            const bool MonteCarlo, Color* out, Guide* guides) {
+  Sampler samplers[SIMD_WIDTH_];
+  RayPacket packet;
+  HitRecord hits[SIMD_WIDTH_];
+  const int found = FirstHits(xs, ys, index, n, samplers, packet, hits, guides);
 
-  int x;
-  int y;
+  // the rest of each path is traced on its own
+  for (int i = 0; i < n; ++i) {
+    if (!(found >> i & 1)) {
+      VCL_STAT_PATH(Escaped, 0);
+      out[i] = Color::Zero();
+    }
+    else if (!MonteCarlo) out[i] = GlobIllum::RayTrace(scene_, packet.Lane(i), hits[i], samplers[i], trace_params_);
+    else out[i] = GlobIllum::PathTrace(scene_, packet.Lane(i), hits[i], samplers[i], trace_params_);
+  }
+}
 
-  Color **buffer = new Color *[height_];
-  int **cnt = new int *[height_];
+void Renderer::SampleWavefront(const int* xs, const int* ys, const uint32_t* index, const int n,
+                               Color* out, Guide* guides) {
+  // the queues keep their capacity from tile to tile
+  thread_local GlobIllum::Wavefront wavefront;
+  int slot[TILE_PIXELS_];
+  for (int first = 0; first < n; first += SIMD_WIDTH_) {
+    const int m = std::min(SIMD_WIDTH_, n - first);
+    Sampler samplers[SIMD_WIDTH_];
+    RayPacket packet;
+    HitRecord hits[SIMD_WIDTH_];
+    const int found = FirstHits(xs + first, ys + first, index + first, m, samplers, packet, hits,
+                                guides ? guides + first : nullptr);
+    for (int i = 0; i < m; ++i) {
+      slot[first + i] = -1;
+      if (found >> i & 1) slot[first + i] = wavefront.Add(packet.Lane(i), hits[i], samplers[i]);
+      else VCL_STAT_PATH(Escaped, 0);
+    }
+  }
 
-  for (y = 0; y < height_; y++) {
-    buffer[y] = new Color[width_];
-    cnt[y] = new int[width_];
-    for (x = 0; x < width_; x++) {
-      buffer[y][x] = Color::Zero();
-      cnt[y][x] = 0;
+  Color radiance[TILE_PIXELS_];
+  wavefront.Trace(scene_, trace_params_, radiance);
+  for (int i = 0; i < n; ++i) out[i] = slot[i] < 0 ? Color::Zero() : radiance[slot[i]];
+}
+
+real Renderer::Progress(const Tile& tile, const bool MonteCarlo, const int max_samples) {
+  // only the pixels still needing samples are traced
+  int xs[TILE_PIXELS_], ys[TILE_PIXELS_];
+  uint32_t index[TILE_PIXELS_];
+  int n = 0;
+
+  // the error is taken before the new samples, which is close enough for
+  // ranking tiles and saves a second pass
+  real error = 0;
+  for (int y = tile.y0_; y < tile.y1_; ++y) {
+    for (int x = tile.x0_; x < tile.x1_; ++x) {
+      const int count = film_->Count(x, y);
+      if (count >= max_samples) continue;
+      if (count >= MIN_SAMPLES_ && noise_threshold_ > 0) {
+        const real e = film_->Error(x, y);
+        if (!(e > noise_threshold_)) continue;
+        error += e;
+      } else {
+        error = std::numeric_limits<real>::infinity();
+      }
+      xs[n] = x;
+      ys[n] = y;
+      index[n] = sample_offset_ + count;
+      ++n;
     }
   }
+  if (n == 0) return error;
 
-  x = y = 0;
-  int idx = 0;
-  const int buffer_size = height_ * width_;
-  int patch_size = 50000;
-  patch_size = patch_size > buffer_size ? buffer_size : patch_size;
+  Color sample[TILE_PIXELS_];
+  Guide guides[TILE_PIXELS_];
+  if (MonteCarlo && wavefront_) {
+    SampleWavefront(xs, ys, index, n, sample, guides);
+  } else {
+    for (int first = 0; first < n; first += SIMD_WIDTH_)
+      SamplePacket(xs + first, ys + first, index + first, std::min(SIMD_WIDTH_, n - first), MonteCarlo,
+                   sample + first, guides + first);
+  }
+  VCL_STAT(Samples, n);
+  for (int i = 0; i < n; ++i) film_->AddSample(xs[i], ys[i], sample[i], guides[i]);
+  return error;
+}
+
+void Renderer::Invalidate() {
+  film_->Reset();
+  if (gbuffer_) gbuffer_->Invalidate();
+  std::fill(tile_error_.begin(), tile_error_.end(), std::numeric_limits<real>::infinity());
+}
+
+void Renderer::TraceDepth(const int y, HitRecord* hits) {
+  for (int x0 = 0; x0 < width_; x0 += SIMD_WIDTH_) {
+    const int n = std::min(SIMD_WIDTH_, width_ - x0);
+    alignas(32) real sx[SIMD_WIDTH_] = {};
+    alignas(32) real sy[SIMD_WIDTH_] = {};
+    for (int i = 0; i < n; ++i) {
+      sx[i] = (x0 + i + real(0.5)) / width_;
+      sy[i] = (y + real(0.5)) / height_;
+    }
+    RayPacket packet;
+    camera_->GeneratePacket(sx, sy, n, packet);
+    VCL_STAT(CameraRays, n);
+    HitRecord lanes[SIMD_WIDTH_];
+    const int found = scene_.IntersectPacket(packet, lanes);
+    for (int i = 0; i < n; ++i) {
+      hits[x0 + i] = lanes[i];
+      float& depth = framebuffer_->depth_[y * width_ + x0 + i];
+      depth = 1;
+      if (!(found >> i & 1)) continue;
+      const Vec4f p = camera_->proj_view_ * lanes[i].pos_.cast<float>().homogeneous();
+      depth = p.z() / p.w();
+    }
+  }
+}
+
+void Renderer::Reproject(const Mat4f& prev_proj_view) {
+  if (!history_) history_ = new Film(width_, height_);
+  std::swap(film_, history_);
+  film_->Reset();
+  if (gbuffer_) gbuffer_->Invalidate();
+  std::fill(tile_error_.begin(), tile_error_.end(), std::numeric_limits<real>::infinity());
+  prev_depth_.assign(framebuffer_->depth_, framebuffer_->depth_ + width_ * height_);
+
+  // NDC depth to distance along the view axis
+  const float n = camera_->z_near_, f = camera_->z_far_;
+  const auto linear = [&](const float z) { return 2 * n * f / (f + n - z * (f - n)); };
+  // new NDC to old pixel coordinates
+  const Mat4f to_prev = prev_proj_view * camera_->proj_view_.inverse();
+  const auto prev_pixel = [&](const Vec4f& ndc) {
+    const Vec4f q = to_prev * ndc;
+    return Vec2f((q.x() / q.w() + 1) / 2 * width_, (q.y() / q.w() + 1) / 2 * height_);
+  };
+  std::atomic<int> reused{0};
+  scheduler_->Run(height_, [&](const int y, int) {
+    thread_local std::vector<HitRecord> hits;
+    hits.resize(width_);
+    TraceDepth(y, hits.data());
+    int count = 0;
+    for (int x = 0; x < width_; ++x) {
+      const HitRecord& hit = hits[x];
+      if (!hit.obj_ || hit.mat_->k_s_.any()) continue;
+      const Vec4f q = prev_proj_view * hit.pos_.cast<float>().homogeneous();
+      if (!(q.w() > 0)) continue;
+      const float u = (q.x() / q.w() + 1) / 2 * width_, v = (q.y() / q.w() + 1) / 2 * height_;
+      if (!(u >= 0 && u < width_ && v >= 0 && v < height_)) continue;
+      const int px = int(u), py = int(v);
+      // the previous pixel saw another surface if its depth or normal differ
+      const float seen = linear(prev_depth_[py * width_ + px]), expected = linear(q.z() / q.w());
+      if (!(std::abs(seen - expected) <= REPROJECT_DEPTH_ * expected)) continue;
+      if (!(history_->MeanGuide(px, py).normal_.dot(hit.n_) >= REPROJECT_NORMAL_)) continue;
+      // the new pixel's sides at the hit's depth, measured in old pixels
+      const Vec4f ndc((x + 0.5f) / width_ * 2 - 1, (y + 0.5f) / height_ * 2 - 1,
+                      framebuffer_->depth_[y * width_ + x], 1);
+      const Vec2f at = prev_pixel(ndc);
+      const float across = (prev_pixel(ndc + Vec4f(2.0f / width_, 0, 0, 0)) - at).norm();
+      const float down = (prev_pixel(ndc + Vec4f(0, 2.0f / height_, 0, 0)) - at).norm();
+      if (!(std::min(across, down) >= REPROJECT_FOOTPRINT_)) continue;
+      film_->CopyPixel(*history_, px, py, x, y, REPROJECT_SAMPLES_);
+      ++count;
+    }
+    reused += count;
+  });
+  spdlog::debug("camera moved, kept the samples of {:.1f}% of the pixels", 100.0 * reused / (width_ * height_));
+}
+
+void Renderer::Preview(const int step, const bool MonteCarlo) {
+  const int cols = (width_ + step - 1) / step, rows = (height_ + step - 1) / step;
+  const size_t plane = size_t(cols) * rows;
+  preview_.resize(3 * plane);
+  float* const rgb[3] = {preview_.data(), preview_.data() + plane, preview_.data() + 2 * plane};
+
+  // a camera ray through the center of the middle pixel of each block, the
+  // last pixel for partial blocks at the edges
+  const auto middle = [step](const int block, const int size) { return std::min(block * step + step / 2, size - 1); };
+  scheduler_->Run(rows, [&](const int by, int) {
+    const int y = middle(by, height_);
+    for (int bx = 0; bx < cols; bx += SIMD_WIDTH_) {
+      const int n = std::min(SIMD_WIDTH_, cols - bx);
+      Sampler samplers[SIMD_WIDTH_];
+      alignas(32) real sx[SIMD_WIDTH_] = {};
+      alignas(32) real sy[SIMD_WIDTH_] = {};
+      for (int i = 0; i < n; ++i) {
+        const int x = middle(bx + i, width_);
+        samplers[i] = Sampler::ForPixel(y * width_ + x, sample_offset_, seed_);
+        sx[i] = (x + real(0.5)) / width_;
+        sy[i] = (y + real(0.5)) / height_;
+      }
+      RayPacket packet;
+      camera_->GeneratePacket(sx, sy, n, packet);
+      VCL_STAT(CameraRays, n);
+      HitRecord hits[SIMD_WIDTH_];
+      const int found = scene_.IntersectPacket(packet, hits);
+      for (int i = 0; i < n; ++i) {
+        Color c = Color::Zero();
+        if (!(found >> i & 1)) VCL_STAT_PATH(Escaped, 0);
+        else if (!MonteCarlo) c = GlobIllum::RayTrace(scene_, packet.Lane(i), hits[i], samplers[i], trace_params_);
+        else c = GlobIllum::PathTrace(scene_, packet.Lane(i), hits[i], samplers[i], trace_params_);
+        for (int k = 0; k < 3; ++k) rgb[k][by * cols + bx + i] = c[k];
+      }
+    }
+  });
+
+  // bilinear between the sampled pixels, before gamma; tap i and its weight
+  // for pixel p of a row or column, the same on every row
+  const auto tap = [&](const int p, const int blocks, const int size, real& weight) {
+    if (blocks == 1) {
+      weight = 0;
+      return 0;
+    }
+    const int i = std::clamp((p - step / 2) / step, 0, blocks - 2);
+    const int a = middle(i, size), b = middle(i + 1, size);
+    weight = std::clamp(real(p - a) / (b - a), real(0), real(1));
+    return i;
+  };
+  std::vector<int> taps(width_);
+  std::vector<real> weights(width_);
+  for (int x = 0; x < width_; ++x) taps[x] = tap(x, cols, width_, weights[x]);
+  scheduler_->Run(height_, [&](const int y, int) {
+    thread_local std::vector<float> row;
+    row.resize(3 * size_t(width_));
+    real fy;
+    const int y0 = tap(y, rows, height_, fy);
+    for (int k = 0; k < 3; ++k) {
+      const float* top = rgb[k] + y0 * cols;
+      const float* bottom = rows > 1 ? top + cols : top;
+      float* out = row.data() + k * width_;
+      for (int x = 0; x < width_; ++x) {
+        const int i = taps[x];
+        const int j = cols > 1 ? i + 1 : i;
+        const real a = top[i] + (top[j] - top[i]) * weights[x];
+        const real b = bottom[i] + (bottom[j] - bottom[i]) * weights[x];
+        out[x] = a + (b - a) * fy;
+      }
+    }
+    ResolveSpan(row.data(), row.data() + width_, row.data() + 2 * width_, nullptr, width_,
+                framebuffer_->color_ + size_t(y) * width_ * 4);
+  });
+}
+
+CheckpointHeader Renderer::MakeCheckpointHeader() const {
+  CheckpointHeader header;
+  header.width_ = width_;
+  header.height_ = height_;
+  header.light_mode_ = lightMode_;
+  header.camera_mode_ = cameraMode_;
+  header.tracing_mode_ = tracingMode_;
+  header.max_depth_ = trace_params_.max_depth_;
+  header.seed_ = seed_;
+  header.sample_offset_ = sample_offset_;
+  header.sample_count_ = sample_count_;
+  header.total_samples_ = total_samples_;
+  header.state_size_ = film_->StateSize();
+  // unfixed scenes place their objects at random
+  uint64_t hash = HashBytes(&trace_params_, sizeof(trace_params_));
+  for (const auto& obj : scene_.objs_) {
+    const AABB box = obj->Bounds();
+    hash = HashBytes(box.min_.data(), sizeof(real) * 3, hash);
+    hash = HashBytes(box.max_.data(), sizeof(real) * 3, hash);
+  }
+  for (const Vec3f* v : {&camera_->pos_, &camera_->up_, &camera_->right_, &camera_->lookat_})
+    hash = HashBytes(v->data(), sizeof(float) * 3, hash);
+  hash = HashBytes(&camera_->fovy_, sizeof(float), hash);
+  header.scene_hash_ = HashBytes(&camera_->aspect_, sizeof(float), hash);
+  return header;
+}
+
+void Renderer::Checkpoint(bool wait) {
+  if (checkpoint_path_.empty()) return;
+  // a final checkpoint must not be skipped for a pending one
+  if (wait) checkpointer_.Wait();
+  if (!checkpointer_.WriteAsync(checkpoint_path_, MakeCheckpointHeader(), *film_)) return;
+  if (wait && !checkpointer_.Wait()) spdlog::error("failed to write checkpoint {}", checkpoint_path_);
+}
+
+bool Renderer::Resume() {
+  if (checkpoint_path_.empty() || !ReadCheckpoint(checkpoint_path_, MakeCheckpointHeader(), *film_))
+    return false;
+  spdlog::info("resumed from {}", checkpoint_path_);
+  return true;
+}
+
+void Renderer::ReportStats(bool final) {
+#ifdef VCL_STATS
+  const auto now = std::chrono::steady_clock::now();
+  const double seconds = std::chrono::duration<double>(now - stats_time_).count();
+  if (!final && seconds < STATS_INTERVAL_) return;
+  const Stats::Snapshot total = Stats::Collect();
+  Stats::Report(total - stats_last_, seconds);
+  stats_last_ = total;
+  stats_time_ = now;
+  if (final && !stats_path_.empty() &&
+      !Stats::WriteJSON(stats_path_, total, std::chrono::duration<double>(now - stats_start_).count()))
+    spdlog::error("failed to write {}", stats_path_);
+#else
+  (void)final;
+#endif
+}
+
+void Renderer::MainLoop() {
+  // switch between ray tracing and path tracing
+  const bool MonteCarlo = tracingMode_;
+
+  // about 50000 pixels between two presents, from the noisiest tiles; an
+  // unsampled tile has infinite error and goes first
+  const int tile_count = int(tiles_.size());
+  const int patch_tiles = std::clamp(50000 / (TILE_SIZE_ * TILE_SIZE_), 1, tile_count);
+  tile_error_.resize(tile_count);
+  Invalidate();
+  Resume();
+  // the depth of the pixel centers, for reprojecting the film on camera moves
+  camera_->UpdateData();
+  scheduler_->Run(height_, [&](const int y, int) {
+    thread_local std::vector<HitRecord> hits;
+    hits.resize(width_);
+    TraceDepth(y, hits.data());
+  });
+  auto last_checkpoint = std::chrono::steady_clock::now();
+  std::vector<int> order(tile_count);
+  // while the camera moves, previews keep up with it and the film waits for
+  // it to stop to be reprojected
+  bool moving = false;
+  Mat4f moved_from;
+  auto last_move = last_checkpoint;
   while (!window_->should_close_) {
     PollInputEvents();
+    if (camera_->view_dirty_ || camera_->proj_dirty_) {
+      if (!moving) moved_from = camera_->proj_view_;
+      camera_->UpdateData();
+      if (preview_fps_ > 0) {
+        moving = true;
+        last_move = std::chrono::steady_clock::now();
+      } else {
+        Reproject(moved_from);
+      }
+    }
+    if (moving) {
+      const auto start = std::chrono::steady_clock::now();
+      if (std::chrono::duration<double>(start - last_move).count() < PREVIEW_HOLD_) {
+        Preview(preview_step_, MonteCarlo);
+        // halving the step quadruples the samples, the margin keeps the
+        // level from flipping back and forth
+        const double frame = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (frame > 1 / preview_fps_) preview_step_ = std::min(2 * preview_step_, TILE_SIZE_);
+        else if (4 * frame < 0.75 / preview_fps_) preview_step_ = std::max(preview_step_ / 2, 1);
+        window_->DrawBuffer(framebuffer_);
+        ReportStats(false);
+        continue;
+      }
+      moving = false;
+      Reproject(moved_from);
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<double>(now - last_checkpoint).count() >= checkpoint_interval_) {
+      Checkpoint(false);
+      last_checkpoint = now;
+    }
 
-    // serial version
-    // for (int i = 0; i < 10; ++i) {
-    //   Progress(x, y, buffer, cnt, MonteCarlo);
-    // }
-
-    // parallel version
-    # pragma omp parallel for
-    for (int i = 0; i < patch_size; ++i) {
-      int p = (idx + i) % buffer_size;
-      int px = p % width_;
-      int py = p / width_;
-      Progress(px, py, buffer, cnt, MonteCarlo);
+    std::iota(order.begin(), order.end(), 0);
+    std::partial_sort(order.begin(), order.begin() + patch_tiles, order.end(),
+                      [&](const int a, const int b) { return tile_error_[a] > tile_error_[b]; });
+    int active = patch_tiles;
+    while (active > 0 && !(tile_error_[order[active - 1]] > 0)) --active;
+    if (active > 0) {
+      scheduler_->Run(active, [&](const int i, int) {
+        const Tile& tile = tiles_[order[i]];
+        tile_error_[order[i]] = Progress(tile, MonteCarlo, std::numeric_limits<int>::max());
+        if (!denoiser_) film_->Resolve(tile.x0_, tile.y0_, tile.x1_, tile.y1_, framebuffer_->color_);
+      });
+      if (denoiser_) Denoise();
+      VCL_STAT(Frames, 1);
+    } else {
+      // everything converged
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
-    idx = (idx + patch_size) % buffer_size;
 
     window_->DrawBuffer(framebuffer_);
+    ReportStats(false);
+  }
+  Checkpoint(true);
+  ReportStats(true);
+}
+
+void Renderer::RenderOffline(const int spp, const std::string& output) {
+  const bool MonteCarlo = tracingMode_;
+  Invalidate();
+  Resume();
+
+  spdlog::info("rendering {}x{} at up to {} spp", width_, height_, spp);
+  const auto start = std::chrono::steady_clock::now();
+  auto last_checkpoint = start;
+
+  // one tile per task, rounds of ROUND_SAMPLES_ per pixel so that the film
+  // can be saved in between; a pixel's samples don't depend on the rounds
+  for (int limit = std::min(spp, ROUND_SAMPLES_);; limit = std::min(spp, limit + ROUND_SAMPLES_)) {
+    scheduler_->Run(int(tiles_.size()), [&](const int t, int) {
+      while (Progress(tiles_[t], MonteCarlo, limit) > 0) {
+      }
+    });
+    VCL_STAT(Frames, 1);
+    ReportStats(false);
+    if (limit == spp) break;
+    const auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<double>(now - last_checkpoint).count() >= checkpoint_interval_) {
+      Checkpoint(false);
+      last_checkpoint = now;
+    }
   }
+  Checkpoint(true);
+
+  int64_t samples = 0;
+  for (int y = 0; y < height_; ++y)
+    for (int x = 0; x < width_; ++x) samples += film_->Count(x, y);
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  spdlog::info("rendered in {:.2f}s ({:.1f} spp on average, {:.2f} Msamples/s)", seconds,
+               double(samples) / (width_ * height_), double(samples) / seconds * 1e-6);
 
-  for (y = 0; y < height_; y++) {
-    delete[] buffer[y];
-    delete[] cnt[y];
+  if (save_film_) {
+    checkpointer_.Wait();
+    if (checkpointer_.WriteAsync(output, MakeCheckpointHeader(), *film_) && checkpointer_.Wait())
+      spdlog::info("saved the film to {}", output);
+    else
+      spdlog::error("failed to write {}", output);
+  } else {
+    Finish(output);
   }
-  delete[] buffer;
-  delete[] cnt;
+  ReportStats(true);
+}
+
+void Renderer::Finish(const std::string& output) {
+  if (!denoiser_) {
+    scheduler_->Run(int(tiles_.size()), [&](const int t, int) {
+      const Tile& tile = tiles_[t];
+      film_->Resolve(tile.x0_, tile.y0_, tile.x1_, tile.y1_, framebuffer_->color_);
+    });
+  } else {
+    const auto denoise_start = std::chrono::steady_clock::now();
+    Denoise();
+    spdlog::info("denoised in {:.1f}ms", std::chrono::duration<double, std::milli>(
+                                             std::chrono::steady_clock::now() - denoise_start).count());
+  }
+
+  if (SaveImage(output)) spdlog::info("saved {}", output);
+  else spdlog::error("failed to write {}", output);
+  if (aov_ && !SaveAOVs(output)) spdlog::error("failed to write the AOVs of {}", output);
+}
+
+bool Renderer::Merge(const std::vector<std::string>& parts, const std::string& output) {
+  CheckpointHeader header;
+  std::vector<CheckpointHeader> merged;
+  film_->Reset();
+  for (const std::string& part : parts) {
+    CheckpointHeader other;
+    if (!ReadCheckpointHeader(part, other)) {
+      spdlog::error("{} is not a film", part);
+      return false;
+    }
+    if (!other.sample_count_) {
+      spdlog::error("{} is not the film of an offline render", part);
+      return false;
+    }
+    if (!merged.empty() && other.total_samples_ != header.total_samples_) {
+      spdlog::error("{} is a part of {} spp, {} of {}", part, other.total_samples_, parts.front(),
+                    header.total_samples_);
+      return false;
+    }
+    // overlapping parts would count the same samples twice
+    const uint64_t begin = other.sample_offset_, end = begin + other.sample_count_;
+    for (size_t i = 0; i < merged.size(); ++i) {
+      if (begin < merged[i].sample_offset_ + uint64_t(merged[i].sample_count_) && merged[i].sample_offset_ < end) {
+        spdlog::error("samples {}-{} of {} overlap those of {}", begin, end - 1, part, parts[i]);
+        return false;
+      }
+    }
+    if (merged.empty()) header = other;
+    header.sample_offset_ = other.sample_offset_;
+    header.sample_count_ = other.sample_count_;
+    if (!MergeCheckpoint(part, header, *film_)) {
+      spdlog::error("{} does not fit {}", part, parts.front());
+      return false;
+    }
+    merged.push_back(other);
+  }
+
+  int64_t samples = 0;
+  for (int y = 0; y < height_; ++y)
+    for (int x = 0; x < width_; ++x) samples += film_->Count(x, y);
+  spdlog::info("merged {} parts ({:.1f} spp on average)", parts.size(), double(samples) / (width_ * height_));
+  Finish(output);
+  return true;
+}
+
+void Renderer::Denoise() {
+  const int bands = (height_ + TILE_SIZE_ - 1) / TILE_SIZE_;
+  const auto rows = [&](const std::function<void(int, int)>& f) {
+    scheduler_->Run(bands, [&](const int b, int) {
+      f(b * TILE_SIZE_, std::min(height_, (b + 1) * TILE_SIZE_));
+    });
+  };
+  rows([&](int y0, int y1) { denoiser_->Load(*film_, y0, y1); });
+  for (int pass = 0; pass < Denoiser::PASSES_; ++pass) {
+    rows([&](int y0, int y1) { denoiser_->Filter(pass, y0, y1); });
+  }
+  rows([&](int y0, int y1) { denoiser_->Resolve(y0, y1, framebuffer_->color_); });
+}
+
+bool Renderer::SaveAOVs(const std::string& path) const {
+  const std::string stem = path.substr(0, path.find_last_of('.'));
+  std::vector<float> albedo(width_ * height_ * 3), normal(albedo.size()), depth(albedo.size());
+  for (int y = 0; y < height_; ++y)
+    for (int x = 0; x < width_; ++x) {
+      const Guide guide = film_->MeanGuide(x, y);
+      const int i = ((height_ - 1 - y) * width_ + x) * 3;
+      for (int k = 0; k < 3; ++k) {
+        albedo[i + k] = guide.albedo_[k];
+        normal[i + k] = guide.normal_[k];
+        depth[i + k] = guide.depth_;
+      }
+    }
+  return WriteHDR(stem + "_albedo.hdr", width_, height_, albedo.data()) &&
+         WriteHDR(stem + "_normal.hdr", width_, height_, normal.data()) &&
+         WriteHDR(stem + "_depth.hdr", width_, height_, depth.data());
+}
+
+bool Renderer::SaveImage(const std::string& path) const {
+  // framebuffer rows are stored bottom-up, image files are top-down
+  const std::string ext = path.size() >= 4 ? path.substr(path.size() - 4) : "";
+  if (ext == ".hdr") {
+    std::vector<float> rgb(width_ * height_ * 3);
+    for (int y = 0; y < height_; ++y)
+      for (int x = 0; x < width_; ++x) {
+        const Color mean = denoiser_ ? denoiser_->Mean(x, y) : film_->Mean(x, y);
+        for (int i = 0; i < 3; ++i) rgb[((height_ - 1 - y) * width_ + x) * 3 + i] = mean[i];
+      }
+    return WriteHDR(path, width_, height_, rgb.data());
+  }
+  std::vector<unsigned char> rgba(width_ * height_ * 4);
+  for (int y = 0; y < height_; ++y)
+    std::copy_n(framebuffer_->color_ + y * width_ * 4, width_ * 4,
+                rgba.data() + (height_ - 1 - y) * width_ * 4);
+  return WritePNG(path, width_, height_, rgba.data());
 }
 
 void Renderer::Destroy() {
+  if (scheduler_) delete scheduler_;
   if (camera_) delete camera_;
   if (framebuffer_) delete framebuffer_;
-  window_->Destroy();
-  if (window_) delete window_;
+  if (film_) delete film_;
+  if (history_) delete history_;
+  if (gbuffer_) delete gbuffer_;
+  if (denoiser_) delete denoiser_;
+  if (window_) {
+    window_->Destroy();
+    delete window_;
+  }
   DestroyPlatform();
 }
 };  // namespace VCL
\ No newline at end of file
@@ -1,12 +1,21 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <string>
 #include <vector>
 
+#include "common/stats.h"
 #include "graphics/camera.h"
+#include "graphics/denoiser.h"
+#include "graphics/film.h"
 #include "graphics/framebuffer.h"
+#include "graphics/gbuffer.h"
+#include "graphics/globillum.h"
 #include "graphics/platform.h"
 #include "graphics/scene.h"
+#include "renderer/checkpoint.h"
+#include "renderer/scheduler.h"
 
 namespace VCL {
 enum class BUTTON : unsigned char { Left = 0, Right, Middle, NUM };
@@ -15,7 +24,15 @@ class Renderer {
  public:
   VWindow* window_ = nullptr;
   Framebuffer* framebuffer_ = nullptr;
+  Film* film_ = nullptr;
+  // the film before the last camera move, see Reproject()
+  Film* history_ = nullptr;
+  Denoiser* denoiser_ = nullptr;
+  // first hits of the camera rays, interactive only
+  GBuffer* gbuffer_ = nullptr;
   Camera* camera_ = nullptr;
+  Scheduler* scheduler_ = nullptr;
+  std::vector<Tile> tiles_;
 
   Scene scene_;
 
@@ -29,11 +46,117 @@ class Renderer {
   int lightMode_ = -1;
   int cameraMode_ = -1;
   int tracingMode_ = false;
+  // sampling and, if not 0, the random object layout
+  uint64_t seed_ = 0;
+  // added to every sample index, so that processes rendering the same image
+  // with different offsets take disjoint samples
+  uint32_t sample_offset_ = 0;
+  // samples per pixel of this render from sample_offset_ on and of the
+  // whole render it is a part of, 0 in the interactive loop; checkpoints
+  // record them so that Merge() finds overlapping parts
+  uint32_t sample_count_ = 0;
+  uint32_t total_samples_ = 0;
+  // offline output is the raw film for Merge() instead of an image
+  bool save_film_ = false;
+  GlobIllum::TraceParams trace_params_;
+  // path tracing runs a tile's paths in stages through GlobIllum::Wavefront
+  bool wavefront_ = false;
+  // a pixel stops sampling once Film::Error() is below this, 0 never stops
+  real noise_threshold_ = real(0.02);
+  // filter the film before showing or saving it, set before Init()
+  bool denoise_ = false;
+  // also write albedo, normal and depth images next to offline output
+  bool aov_ = false;
+  // remaining error of each tile of tiles_ in the interactive loop
+  std::vector<real> tile_error_;
+  // framebuffer_->depth_ before the last camera move
+  std::vector<float> prev_depth_;
+  // frame rate held by previews while the camera moves, 0 refines the full
+  // image throughout
+  double preview_fps_ = 30.0;
+  // pixels per side of the blocks that share one preview sample, adapted
+  // to preview_fps_
+  int preview_step_ = 4;
+  // the preview samples, a plane per channel
+  std::vector<float> preview_;
+  // resume from and periodically save the film to this file, if not empty
+  std::string checkpoint_path_;
+  double checkpoint_interval_ = 60.0;
+  Checkpointer checkpointer_;
+  // JSON dump of the render statistics at exit, needs a VCL_STATS build
+  std::string stats_path_;
+  Stats::Snapshot stats_last_;
+  std::chrono::steady_clock::time_point stats_start_, stats_time_;
   
-  void Init(const std::string& title, int width, int height,
-            bool isFix, int lightMode, int cameraMode, bool tracingMode);
-  void Progress(int &x, int &y, Color **buffer, int **cnt, const bool MonteCarlo);
+  // the scene file to load instead of the built-in room, if not empty
+  std::string scene_path_;
+  
+  // false if scene_path_ cannot be loaded
+  bool Init(const std::string& title, int width, int height,
+            bool isFix, int lightMode, int cameraMode, bool tracingMode,
+            bool offline = false);
+  // Only the film and what resolves and saves it, no window, camera or
+  // scene: all that Merge() needs. Init() calls it.
+  void InitFilm(int width, int height);
+  // the room of isFix_, lightMode_ and cameraMode_, randomized if not fixed
+  void BuildRoom();
+  Color Sample(const int x, const int y, const uint32_t index, const bool MonteCarlo);
+  // Camera rays of n <= SIMD_WIDTH_ pixel samples as a packet, their first
+  // hits from the G-buffer or traced, and the samplers to go on with. guides,
+  // if given, receives the hits' features. Returns the mask of lanes that hit.
+  int FirstHits(const int* xs, const int* ys, const uint32_t* index, const int n,
+                Sampler* samplers, RayPacket& packet, HitRecord* hits, Guide* guides);
+  // One sample for each of n <= SIMD_WIDTH_ pixels, primary rays traced as a
+  // packet. guides, if given, receives the first hits' features.
+  void SamplePacket(const int* xs, const int* ys, const uint32_t* index, const int n,
+                    const bool MonteCarlo, Color* out, Guide* guides = nullptr);
+  // One path traced sample for each of n <= TILE_SIZE_^2 pixels, all paths
+  // advanced together by a Wavefront.
+  void SampleWavefront(const int* xs, const int* ys, const uint32_t* index, const int n,
+                       Color* out, Guide* guides = nullptr);
+  // Adds one sample to every pixel of the tile that has neither converged
+  // nor reached max_samples. Returns the summed error of the pixels that
+  // got one, 0 once there are none. Does not resolve the framebuffer.
+  real Progress(const Tile& tile, const bool MonteCarlo, const int max_samples);
+  // Drops all samples and cached first hits, call after the scene changed.
+  void Invalidate();
+  // Traces the pixel centers of row y into hits (width_ of them) and writes
+  // their depth under camera_->proj_view_ to framebuffer_->depth_, 1 where
+  // nothing is hit.
+  void TraceDepth(const int y, HitRecord* hits);
+  // Carries the film over to the camera's new view, prev_proj_view being
+  // the one it was rendered with: each pixel takes over the samples of the
+  // pixel that saw its surface before, confirmed by that pixel's depth and
+  // normal, down-weighted so that it keeps refining. Disoccluded,
+  // magnified and view-dependent (specular) surfaces start over.
+  void Reproject(const Mat4f& prev_proj_view);
+  // Traces one sample per step x step block, bypassing film and G-buffer,
+  // and writes them bilinearly upscaled to the framebuffer.
+  void Preview(const int step, const bool MonteCarlo);
+  // Identifies the image a checkpoint belongs to.
+  CheckpointHeader MakeCheckpointHeader() const;
+  // Writes the film to checkpoint_path_, in the background unless wait.
+  // No sample may be added while it is called.
+  void Checkpoint(bool wait);
+  // Loads checkpoint_path_ into the film if it fits this render.
+  bool Resume();
+  // runs the denoiser on the whole film into the framebuffer
+  void Denoise();
+  // Logs the statistics gathered since the last report every few seconds,
+  // or now if final, which also writes stats_path_.
+  void ReportStats(bool final);
   void MainLoop();
+  // renders a fixed sample budget without a window and writes png/hdr
+  void RenderOffline(const int spp, const std::string& output);
+  // Sums the raw films written by offline renders with save_film_, which
+  // must come from the same settings, and saves the image like them.
+  bool Merge(const std::vector<std::string>& parts, const std::string& output);
+  // resolves or denoises the film and saves it with its AOVs
+  void Finish(const std::string& output);
+  // .hdr writes the film's means, anything else the framebuffer as png
+  bool SaveImage(const std::string& path) const;
+  // <stem>_albedo.hdr, <stem>_normal.hdr and <stem>_depth.hdr of path
+  bool SaveAOVs(const std::string& path) const;
   void Destroy();
 
 
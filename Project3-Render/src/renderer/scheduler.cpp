@@ -0,0 +1,133 @@
+#include "scheduler.h"
+
+#include <algorithm>
+
+namespace VCL {
+namespace {
+// spreads the low 16 bits of x to the even bits
+uint32_t Part1By1(uint32_t x) {
+  x &= 0x0000ffff;
+  x = (x | (x << 8)) & 0x00ff00ff;
+  x = (x | (x << 4)) & 0x0f0f0f0f;
+  x = (x | (x << 2)) & 0x33333333;
+  x = (x | (x << 1)) & 0x55555555;
+  return x;
+}
+}  // namespace
+
+std::vector<Tile> MakeTiles(int width, int height, int size) {
+  const int nx = (width + size - 1) / size;
+  const int ny = (height + size - 1) / size;
+  std::vector<std::pair<uint32_t, Tile>> keyed;
+  keyed.reserve(nx * ny);
+  for (int ty = 0; ty < ny; ++ty) {
+    for (int tx = 0; tx < nx; ++tx) {
+      const Tile tile{tx * size, ty * size, std::min(width, (tx + 1) * size),
+                      std::min(height, (ty + 1) * size)};
+      keyed.emplace_back(Part1By1(tx) | Part1By1(ty) << 1, tile);
+    }
+  }
+  // a non power of two grid leaves gaps in the curve, sorting skips them
+  std::sort(keyed.begin(), keyed.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  std::vector<Tile> tiles;
+  tiles.reserve(keyed.size());
+  for (const auto& k : keyed) tiles.push_back(k.second);
+  return tiles;
+}
+
+Scheduler::Scheduler(int threads) {
+  if (threads <= 0) threads = int(std::thread::hardware_concurrency());
+  threads_ = std::max(threads, 1);
+  queues_ = std::make_unique<Queue[]>(threads_);
+  for (int t = 1; t < threads_; ++t) {
+    workers_.emplace_back(&Scheduler::WorkerLoop, this, t);
+  }
+}
+
+Scheduler::~Scheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  start_.notify_all();
+  for (auto& worker : workers_) worker.join();
+}
+
+void Scheduler::Run(int count, const std::function<void(int, int)>& task) {
+  if (count <= 0) return;
+  for (int t = 0; t < threads_; ++t) {
+    queues_[t].range_.store(Pack(uint32_t(int64_t(count) * t / threads_),
+                                 uint32_t(int64_t(count) * (t + 1) / threads_)));
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_ = &task;
+    running_ = threads_ - 1;
+    ++generation_;
+  }
+  start_.notify_all();
+
+  Work(0);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_.wait(lock, [this] { return running_ == 0; });
+  task_ = nullptr;
+}
+
+void Scheduler::WorkerLoop(int thread) {
+  uint64_t seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_.wait(lock, [&] { return quit_ || generation_ != seen; });
+      if (quit_) return;
+      seen = generation_;
+    }
+    Work(thread);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--running_ == 0) done_.notify_one();
+    }
+  }
+}
+
+void Scheduler::Work(int thread) {
+  int index;
+  do {
+    while (Pop(thread, index)) (*task_)(index, thread);
+  } while (Steal(thread));
+}
+
+bool Scheduler::Pop(int thread, int& index) {
+  std::atomic<uint64_t>& range = queues_[thread].range_;
+  uint64_t r = range.load(std::memory_order_relaxed);
+  for (;;) {
+    const uint32_t begin = uint32_t(r), end = uint32_t(r >> 32);
+    if (begin >= end) return false;
+    if (range.compare_exchange_weak(r, Pack(begin + 1, end))) {
+      index = int(begin);
+      return true;
+    }
+  }
+}
+
+bool Scheduler::Steal(int thread) {
+  // only called with an empty own queue, which nobody else writes to
+  for (int i = 1; i < threads_; ++i) {
+    std::atomic<uint64_t>& victim = queues_[(thread + i) % threads_].range_;
+    uint64_t r = victim.load(std::memory_order_relaxed);
+    for (;;) {
+      const uint32_t begin = uint32_t(r), end = uint32_t(r >> 32);
+      if (begin >= end) break;
+      const uint32_t mid = begin + (end - begin) / 2;
+      if (victim.compare_exchange_weak(r, Pack(begin, mid))) {
+        queues_[thread].range_.store(Pack(mid, end));
+        return true;
+      }
+    }
+  }
+  return false;
+}
+};  // namespace VCL
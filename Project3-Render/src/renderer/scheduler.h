@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace VCL {
+constexpr int TILE_SIZE_ = 16;
+
+// Pixels [x0_, x1_) x [y0_, y1_).
+struct Tile {
+  int x0_, y0_;
+  int x1_, y1_;
+};
+
+// Splits the image into square tiles, ordered along a Morton curve so that
+// consecutive tiles are close on screen.
+std::vector<Tile> MakeTiles(int width, int height, int size = TILE_SIZE_);
+
+// Persistent thread pool. Run() splits the tasks into one contiguous range
+// per thread; a thread that runs out steals half of another thread's
+// remaining range, so uneven task costs do not leave threads idle.
+class Scheduler {
+ public:
+  // threads <= 0 uses one thread per hardware thread
+  explicit Scheduler(int threads = 0);
+  ~Scheduler();
+  Scheduler(const Scheduler&) = delete;
+  Scheduler& operator=(const Scheduler&) = delete;
+
+  int Threads() const { return threads_; }
+
+  // Calls task(index, thread) for every index in [0, count) and returns once
+  // all calls are done. The calling thread works as thread 0.
+  void Run(int count, const std::function<void(int, int)>& task);
+
+ private:
+  // [begin, end) packed into one word, begin in the low half
+  struct alignas(64) Queue {
+    std::atomic<uint64_t> range_{0};
+  };
+
+  static uint64_t Pack(uint32_t begin, uint32_t end) {
+    return uint64_t(end) << 32 | begin;
+  }
+
+  void WorkerLoop(int thread);
+  void Work(int thread);
+  bool Pop(int thread, int& index);
+  bool Steal(int thread);
+
+  int threads_;
+  std::unique_ptr<Queue[]> queues_;
+  std::vector<std::thread> workers_;
+
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+  const std::function<void(int, int)>* task_ = nullptr;
+  uint64_t generation_ = 0;
+  int running_ = 0;
+  bool quit_ = false;
+};
+};  // namespace VCL
@@ -1,14 +1,26 @@
 set_project("software-rendering")
 set_xmakever("2.6.1")
 
-add_requires("eigen", "spdlog", "stb", "openmp")
+add_requires("eigen", "spdlog", "stb")
 add_rules("mode.release", "mode.debug")
 set_languages("cxx17")
 
-target("SoftRender")
-    set_kind("binary")
-    add_includedirs("src")
-    add_files("src/main.cpp", "src/common/*.cpp", "src/graphics/*.cpp", "src/renderer/*.cpp")
+-- off by default so that one binary runs on any x86-64 CPU; the batch
+-- kernels pick AVX2 at run time either way
+option("avx2")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Build everything with AVX2 for 8-wide ray packets, SSE2 (4-wide) otherwise; needs an AVX2 CPU")
+option_end()
+
+option("stats")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Count rays, primitive tests and path ends, reported while rendering")
+    add_defines("VCL_STATS")
+option_end()
+
+function add_platform_files()
     if is_plat("windows", "mingw") then
         add_files("src/platforms/win32.cpp")
         add_syslinks("Gdi32", "User32")
@@ -16,6 +28,49 @@ target("SoftRender")
         add_frameworks("Cocoa")
         add_files("src/platforms/macos.mm")
         set_values("objc++.build.arc", false)
+    elseif is_plat("linux") then
+        add_files("src/platforms/headless.cpp")
+        add_syslinks("pthread")
+    end
+end
+
+-- batch intersection kernels, each built for its instruction set; the best
+-- one the CPU supports is picked at run time (src/graphics/batch.cpp)
+function add_kernel_files()
+    if is_arch("x86_64", "x64", "i386", "x86") then
+        if is_plat("windows") then
+            add_files("src/graphics/kernels/batch_sse4.cpp")
+            add_files("src/graphics/kernels/batch_avx2.cpp", {cxflags = "/arch:AVX2"})
+        else
+            add_files("src/graphics/kernels/batch_sse4.cpp", {cxflags = "-msse4.1"})
+            add_files("src/graphics/kernels/batch_avx2.cpp", {cxflags = "-mavx2"})
+        end
+    end
+end
+
+target("SoftRender")
+    set_kind("binary")
+    add_includedirs("src")
+    if has_config("avx2") then
+        add_vectorexts("avx2", "fma")
+    end
+    add_options("stats")
+    add_files("src/main.cpp", "src/common/*.cpp", "src/graphics/*.cpp", "src/renderer/*.cpp")
+    add_kernel_files()
+    add_platform_files()
+    add_packages("eigen", "spdlog", "stb", {public=true})
+    set_targetdir("bin")
+
+target("bench")
+    set_kind("binary")
+    set_default(false)
+    add_includedirs("src")
+    if has_config("avx2") then
+        add_vectorexts("avx2", "fma")
     end
-    add_packages("eigen", "spdlog", "stb", "openmp", {public=true})
+    add_options("stats")
+    add_files("src/bench/bench.cpp", "src/common/*.cpp", "src/graphics/*.cpp", "src/renderer/*.cpp")
+    add_kernel_files()
+    add_platform_files()
+    add_packages("eigen", "spdlog", "stb")
     set_targetdir("bin")